@@ -7,19 +7,26 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* for sched_setaffinity and the CPU_* macros */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -29,28 +36,34 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define STREAM_CHUNK 65536 /* requests per chunk when streaming a trace (-S) */
+#define MAP_MIN     1024 /* smallest id map, in entries */
+
+/* Which parts of eval_trace to run */
+#define EVAL_CHECK   0x1 /* check the trace and measure utilization */
+#define EVAL_SPEED   0x2 /* measure throughput (if the trace was valid) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The records form a treap:
+ * a binary search tree ordered by lo (live payloads never overlap, so
+ * hi is ordered too) that is also a heap on a random prio, which keeps
+ * it balanced in expectation.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    unsigned int prio;     /* random treap priority */
+    struct range_t *left;  /* payloads below this one */
+    struct range_t *right; /* payloads above this one */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
@@ -58,10 +71,60 @@ typedef struct {
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
+    void *map;           /* mapped binary trace that ops points into, or NULL */
+    size_t map_len;      /* ... and its length */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
 } trace_t;
 
+/*
+ * When a trace is streamed (-S), the reader renames each block id to a
+ * slot, a small number that is reused once its block is freed, so the
+ * replay keeps its blocks in a plain array no longer than the most
+ * blocks live at once. Ids are mapped to slots by a hash map,
+ * open-addressed with linear probing, that grows and shrinks with the
+ * number of live blocks, not with num_ids.
+ */
+typedef struct {
+    int id;              /* block id, or -1 if the entry is empty */
+    int slot;            /* the slot the block is kept in */
+} id_slot_t;
+
+typedef struct {
+    id_slot_t *table;    /* the table, a power of two long ... */
+    unsigned mask;       /* ... minus one */
+    unsigned count;      /* number of live blocks in it */
+    int *free_slots;     /* slots whose blocks were freed ... */
+    int nfree;           /* ... how many of them there are ... */
+    int nslots;          /* ... the number of slots handed out so far */
+    int max_slots;       /* ... and the room in free_slots */
+} slot_map_t;
+
+/* A block of a streamed replay, found by its slot */
+typedef struct {
+    char *p;             /* payload returned by the allocator, or NULL */
+    int size;            /* payload size */
+} block_t;
+
+/*
+ * Reads a trace for a streamed replay. A thread reads one chunk of
+ * requests ahead of the one being replayed, alternating between two
+ * buffers, and renames the ids in it to slots.
+ */
+typedef struct {
+    trace_stream_t *ts;
+    slot_map_t map;      /* the live ids, owned by the reader */
+    traceop_t *buf[2];   /* the two chunks ... */
+    int n[2];            /* ... the number of requests in each ... */
+    int nslots[2];       /* ... the slots the replay needs by its end ... */
+    int full[2];         /* ... and whether it is waiting to be replayed */
+    int cur;             /* chunk being replayed, or -1 */
+    int stop;            /* tells the reader to quit */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+} prefetch_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -85,11 +148,27 @@ typedef struct {
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* What a worker process sends back to the driver (-j) */
+typedef struct {
+    stats_t stats;   /* its results for the trace */
+    int errors;      /* the number of errors it found */
+} result_t;
+
+/* A worker process evaluating one trace (-j) */
+typedef struct {
+    pid_t pid;       /* the process, or 0 if this slot is free */
+    int tracenum;    /* the trace it evaluates */
+    int fd;          /* the pipe its result_t comes back on */
+} worker_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int check_every = 0; /* if set, run mm_check every so many ops (-c) */
+static int alloc_stats = 0; /* if set, print the allocator counters (-s) */
+static int stream = 0;  /* if set, stream the traces as they are replayed (-S) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -105,11 +184,13 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *insert_range(range_t *root, range_t *r);
+static range_t *merge_ranges(range_t *a, range_t *b);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
@@ -125,8 +206,22 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
 
+/* Routines for replaying a trace as it is read (-S) */
+static int eval_mm_stream(char *path, int tracenum, range_t **ranges,
+			  stats_t *stats);
+static double eval_mm_stream_speed(char *path);
+
+/* Routines for evaluating the traces one by one or in parallel (-j) */
+static void eval_trace(char *tracefile, int tracenum, int libc, int phases,
+		       stats_t *stats);
+static void eval_parallel(char **tracefiles, int num_tracefiles, int libc,
+			  int phases, int jobs, stats_t *stats);
+static void eval_traces(char **tracefiles, int num_tracefiles, int libc,
+			int jobs, int isolate, stats_t *stats);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printallocstats(int tracenum, char *tracefile);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -141,15 +236,16 @@ int main(int argc, char **argv)
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
-    trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    long heap_mb = 0;    /* If set, heap size in MB for memlib (set by -H) */
+    int huge_pages = 0;  /* If set, put the heap on huge pages (set by -T) */
+    int jobs = 0;        /* If set, evaluate this many traces at once (-j) */
+    int isolate = 0;     /* If set, time the traces one at a time (set by -I) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +254,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:c:H:j:IThvVgalsS")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,6 +274,39 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+	case 'H': /* Heap size in MB */
+	    heap_mb = atol(optarg);
+	    /* its byte size must fit in a size_t (less than 4096 MB with -m32) */
+	    if (heap_mb <= 0 || heap_mb > 4096 || (size_t)heap_mb > SIZE_MAX >> 20) {
+		fprintf(stderr, "ERROR: -H takes a heap size of 1 to %lu MB\n",
+			(unsigned long)(SIZE_MAX >> 20 < 4096 ? SIZE_MAX >> 20 : 4096));
+		exit(1);
+	    }
+	    break;
+	case 'c': /* Check the heap every N operations */
+	    if ((check_every = atoi(optarg)) <= 0) {
+		fprintf(stderr, "ERROR: -c takes a positive number of operations\n");
+		exit(1);
+	    }
+	    break;
+	case 'j': /* Evaluate up to N traces at once */
+	    if ((jobs = atoi(optarg)) <= 0 || jobs > CPU_SETSIZE) {
+		fprintf(stderr, "ERROR: -j takes 1 to %d jobs\n", CPU_SETSIZE);
+		exit(1);
+	    }
+	    break;
+	case 'I': /* With -j, time the traces one at a time */
+	    isolate = 1;
+	    break;
+	case 's': /* Print the allocator's counters for each trace */
+	    alloc_stats = 1;
+	    break;
+	case 'S': /* Stream each trace instead of loading it */
+	    stream = 1;
+	    break;
+	case 'T': /* Transparent huge pages for the heap */
+	    huge_pages = 1;
+	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
@@ -228,6 +357,11 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    if (stream && run_libc) {
+	fprintf(stderr, "ERROR: -l cannot be used with -S\n");
+	exit(1);
+    }
+
     /* Initialize the timing package */
     init_fsecs();
 
@@ -244,20 +378,7 @@ int main(int argc, char **argv)
 	    unix_error("libc_stats calloc in main failed");
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
-	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
-	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
-		if (verbose > 1)
-		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-	    }
-	    free_trace(trace);
-	}
+	eval_traces(tracefiles, num_tracefiles, 1, jobs, isolate, libc_stats);
 
 	/* Display the libc results in a compact table */
 	if (verbose) {
@@ -278,27 +399,15 @@ int main(int argc, char **argv)
 	unix_error("mm_stats calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
+    if (heap_mb)
+	mem_set_maxheap((size_t)heap_mb << 20);
+    mem_set_hugepages(huge_pages);
     mem_init(); 
+    if (huge_pages && mem_hugepagesize() == 0)
+	printf("Warning: no transparent huge pages, using normal pages\n");
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    eval_traces(tracefiles, num_tracefiles, 0, jobs, isolate, mm_stats);
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -360,22 +469,24 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks; each check,
+ * insertion and removal takes O(log n) expected time.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
+    static unsigned int seed = 2463534242u; /* xorshift state for prio */
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *below = NULL, *above = NULL;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -388,56 +499,120 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap (or a mapping) */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_is_mapped(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. Only the
+     * payloads just below and just above lo can.
+     */
+    for (p = *ranges;  p != NULL; ) {
+	if (p->lo <= lo) {
+	    below = p;
+	    p = p->right;
+	}
+	else {
+	    above = p;
+	    p = p->left;
+	}
+    }
+    if (below != NULL && below->hi >= lo)
+	p = below;
+    else if (above != NULL && above->lo <= hi)
+	p = above;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    p->prio = seed;
+    p->left = p->right = NULL;
+    *ranges = insert_range(*ranges, p);
     return 1;
 }
 
+/*
+ * insert_range - insert r (which overlaps no payload in the tree) into
+ *     the treap at root and return the new root
+ */
+static range_t *insert_range(range_t *root, range_t *r)
+{
+    range_t *top;
+
+    if (root == NULL)
+	return r;
+    if (r->lo < root->lo) {
+	root->left = insert_range(root->left, r);
+	if (root->left->prio > root->prio) { /* rotate right */
+	    top = root->left;
+	    root->left = top->right;
+	    top->right = root;
+	    return top;
+	}
+    }
+    else {
+	root->right = insert_range(root->right, r);
+	if (root->right->prio > root->prio) { /* rotate left */
+	    top = root->right;
+	    root->right = top->left;
+	    top->left = root;
+	    return top;
+	}
+    }
+    return root;
+}
+
+/*
+ * merge_ranges - join two treaps, all of whose payloads in a lie below
+ *     those in b, and return the root of the result
+ */
+static range_t *merge_ranges(range_t *a, range_t *b)
+{
+    if (a == NULL)
+	return b;
+    if (b == NULL)
+	return a;
+    if (a->prio > b->prio) {
+	a->right = merge_ranges(a->right, b);
+	return a;
+    }
+    b->left = merge_ranges(a, b->left);
+    return b;
+}
+
 /* 
  * remove_range - Free the range record of block whose payload starts at lo 
  */
 static void remove_range(range_t **ranges, char *lo)
 {
+    range_t **pp = ranges;
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *pp) != NULL && p->lo != lo)
+	pp = (lo < p->lo) ? &p->left : &p->right;
+    if (p != NULL) {
+	*pp = merge_ranges(p->left, p->right);
+	free(p);
     }
 }
 
@@ -446,12 +621,12 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    if (p != NULL) {
+	clear_ranges(&p->left);
+	clear_ranges(&p->right);
+	free(p);
     }
     *ranges = NULL;
 }
@@ -462,17 +637,14 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file (text or binary, see trace.h) and
+ *              store it in memory
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
+    trace_header_t hdr;
     char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -481,22 +653,17 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
 	
-    /* Read the trace file header */
+    /* Read the header and the requests; a binary trace is mapped */
     strcpy(path, tracedir);
     strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
+    if (trace_load(path, &hdr, &trace->ops, &trace->map, &trace->map_len) < 0) {
+	sprintf(msg, "Could not read %s in read_trace", path);
+	app_error(msg);
+    }
+    trace->sugg_heapsize = hdr.sugg_heapsize; /* not used */
+    trace->num_ids = hdr.num_ids;
+    trace->num_ops = hdr.num_ops;
+    trace->weight = hdr.weight;               /* not used */
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks = 
@@ -508,52 +675,17 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
     
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
-	op_index++;
-	
-    }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
     return trace;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * free_trace - Free the trace record, its requests (trace_unload
+ *              unmaps them if they came from a binary trace), and the
+ *              two block arrays allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    trace_unload(trace->ops, trace->map, trace->map_len);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -577,7 +709,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -604,7 +736,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
@@ -622,6 +754,28 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    trace->block_sizes[index] = size;
 	    break;
 
+        case MEMALIGN: /* mm_memalign */
+
+	    /* Call the student's memalign */
+	    if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_memalign failed.");
+		return 0;
+	    }
+
+	    /* The block must also honour the requested alignment */
+	    if ((unsigned long)p % trace->ops[i].align != 0) {
+		malloc_error(tracenum, i, "mm_memalign returned a misaligned block.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+
+	    /* Remember region */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
         case REALLOC: /* mm_realloc */
 	    
 	    /* Call the student's realloc */
@@ -631,10 +785,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range tree */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
@@ -646,7 +800,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -671,6 +825,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* Optionally let the package check its own heap */
+	if (check_every && (i + 1) % check_every == 0 && !mm_check()) {
+	    malloc_error(tracenum, i, "mm_check found an inconsistent heap.");
+	    return 0;
+	}
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -682,10 +841,9 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   peak footprint in bytes (heap plus any mem_map mappings) while
+ *   running the student's malloc package on the trace. Without
+ *   mappings this is the high water mark of the brk pointer.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -707,10 +865,15 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case MEMALIGN: /* mm_memalign */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if (trace->ops[i].type == MEMALIGN)
+		p = mm_memalign(trace->ops[i].align, size);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -767,7 +930,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peaksize());
 }
 
 
@@ -798,6 +961,14 @@ static void eval_mm_speed(void *ptr)
             trace->blocks[index] = p;
             break;
 
+        case MEMALIGN: /* mm_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
 	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -840,6 +1011,14 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    trace->blocks[trace->ops[i].index] = p;
 	    break;
 
+        case MEMALIGN: /* aligned_alloc */
+	    if ((p = aligned_alloc(trace->ops[i].align, trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc aligned_alloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
 	case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[trace->ops[i].index];
@@ -884,6 +1063,14 @@ static void eval_libc_speed(void *ptr)
 	    trace->blocks[index] = p;
 	    break;
 
+        case MEMALIGN: /* aligned_alloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = aligned_alloc(trace->ops[i].align, size)) == NULL)
+		unix_error("aligned_alloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
 	case REALLOC: /* realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
@@ -903,11 +1090,647 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/*********************************************************************
+ * The following routines run the evaluations above on each trace,
+ * either one after another in this process or (-j) in parallel worker
+ * processes, each with a heap of its own.
+ *********************************************************************/
+
+/*
+ * eval_trace - evaluate the mm package (or libc malloc, if libc is
+ *     set) on one trace: check it and measure its utilization
+ *     (EVAL_CHECK), then time it if it is valid (EVAL_SPEED). The
+ *     results go in *stats.
+ */
+static void eval_trace(char *tracefile, int tracenum, int libc, int phases,
+		       stats_t *stats)
+{
+    trace_t *trace;
+    range_t *ranges = NULL;
+    speed_t speed_params;
+    char path[MAXLINE];
+
+    if (stream) {
+	/* One streamed pass checks the trace, another times it */
+	strcpy(path, tracedir);
+	strcat(path, tracefile);
+	if (phases & EVAL_CHECK) {
+	    if (verbose > 1)
+		printf("Streaming tracefile: %s\n", tracefile);
+	    stats->valid = eval_mm_stream(path, tracenum, &ranges, stats);
+	    if (stats->valid && alloc_stats)
+		printallocstats(tracenum, tracefile);
+	    clear_ranges(&ranges);
+	}
+	if ((phases & EVAL_SPEED) && stats->valid)
+	    stats->secs = eval_mm_stream_speed(path);
+	return;
+    }
+
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
+    if (phases & EVAL_CHECK) {
+	if (verbose > 1)
+	    printf("Checking %s for correctness, ",
+		   libc ? "libc malloc" : "mm_malloc");
+	if (libc)
+	    stats->valid = eval_libc_valid(trace, tracenum);
+	else {
+	    stats->valid = eval_mm_valid(trace, tracenum, &ranges);
+	    if (stats->valid) {
+		if (verbose > 1)
+		    printf("efficiency, ");
+		stats->util = eval_mm_util(trace, tracenum, &ranges);
+		if (alloc_stats)
+		    printallocstats(tracenum, tracefile);
+	    }
+	}
+    }
+    if ((phases & EVAL_SPEED) && stats->valid) {
+	speed_params.trace = trace;
+	speed_params.ranges = ranges;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	stats->secs = fsecs(libc ? eval_libc_speed : eval_mm_speed,
+			    &speed_params);
+    }
+    clear_ranges(&ranges);
+    free_trace(trace);
+}
+
+/*
+ * eval_parallel - run eval_trace on each trace in a worker process of
+ *     its own, up to jobs of them at once, each pinned to a different
+ *     CPU (as far as there are enough). A worker that dies counts as an
+ *     error and leaves its trace invalid. With only EVAL_SPEED, the
+ *     traces found invalid before are skipped.
+ */
+static void eval_parallel(char **tracefiles, int num_tracefiles, int libc,
+			  int phases, int jobs, stats_t *stats)
+{
+    cpu_set_t allowed, one;
+    int cpus[CPU_SETSIZE], ncpus = 0;
+    worker_t *workers;
+    result_t result;
+    int fds[2];
+    int i, next, running, slot, status;
+    pid_t pid;
+
+    /* The CPUs we may run on; workers take them in turn by slot */
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+	for (i = 0; i < CPU_SETSIZE; i++)
+	    if (CPU_ISSET(i, &allowed))
+		cpus[ncpus++] = i;
+
+    if ((workers = (worker_t *)calloc(jobs, sizeof(worker_t))) == NULL)
+	unix_error("calloc failed in eval_parallel");
+
+    next = 0;
+    running = 0;
+    while (next < num_tracefiles || running > 0) {
+
+	/* Start workers on the next traces while there are free slots */
+	while (running < jobs && next < num_tracefiles) {
+	    i = next++;
+	    if (!(phases & EVAL_CHECK) && !stats[i].valid)
+		continue;
+	    for (slot = 0; workers[slot].pid != 0; slot++)
+		;
+	    if (pipe(fds) < 0)
+		unix_error("pipe failed in eval_parallel");
+	    fflush(stdout); /* or the worker would print it again */
+	    if ((pid = fork()) < 0)
+		unix_error("fork failed in eval_parallel");
+
+	    if (pid == 0) {
+		close(fds[0]);
+		if (ncpus > 0) {
+		    CPU_ZERO(&one);
+		    CPU_SET(cpus[slot % ncpus], &one);
+		    sched_setaffinity(0, sizeof(one), &one);
+		}
+		if (!libc) { /* a heap of its own, not the driver's copy */
+		    mem_deinit();
+		    mem_init();
+		}
+		errors = 0;
+		result.stats = stats[i];
+		eval_trace(tracefiles[i], i, libc, phases, &result.stats);
+		result.errors = errors;
+		fflush(stdout);
+		if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+		    _exit(1);
+		_exit(0);
+	    }
+
+	    close(fds[1]);
+	    workers[slot].pid = pid;
+	    workers[slot].tracenum = i;
+	    workers[slot].fd = fds[0];
+	    running++;
+	}
+	if (running == 0)
+	    break;
+
+	/* Collect the result of whichever worker finishes first */
+	if ((pid = wait(&status)) < 0)
+	    unix_error("wait failed in eval_parallel");
+	for (slot = 0; slot < jobs && workers[slot].pid != pid; slot++)
+	    ;
+	if (slot == jobs)
+	    continue;
+	i = workers[slot].tracenum;
+	if (read(workers[slot].fd, &result, sizeof(result)) == sizeof(result)) {
+	    stats[i] = result.stats;
+	    errors += result.errors;
+	}
+	else {
+	    errors++;
+	    if (WIFSIGNALED(status))
+		printf("ERROR [trace %d]: worker killed by signal %d\n",
+		       i, WTERMSIG(status));
+	    else
+		printf("ERROR [trace %d]: worker exited without a result\n", i);
+	    stats[i].valid = 0;
+	}
+	close(workers[slot].fd);
+	workers[slot].pid = 0;
+	running--;
+    }
+    free(workers);
+}
+
+/*
+ * eval_traces - evaluate every trace, one after another, or with jobs
+ *     set in parallel worker processes. With isolate set as well, the
+ *     workers only check the traces and measure utilization; the
+ *     traces are then timed one at a time, so the timings do not
+ *     compete for cores, caches or memory bandwidth.
+ */
+static void eval_traces(char **tracefiles, int num_tracefiles, int libc,
+			int jobs, int isolate, stats_t *stats)
+{
+    int i;
+
+    if (jobs == 0) {
+	for (i = 0; i < num_tracefiles; i++)
+	    eval_trace(tracefiles[i], i, libc, EVAL_CHECK | EVAL_SPEED,
+		       &stats[i]);
+    }
+    else if (isolate) {
+	eval_parallel(tracefiles, num_tracefiles, libc, EVAL_CHECK, jobs,
+		      stats);
+	eval_parallel(tracefiles, num_tracefiles, libc, EVAL_SPEED, 1, stats);
+    }
+    else
+	eval_parallel(tracefiles, num_tracefiles, libc,
+		      EVAL_CHECK | EVAL_SPEED, jobs, stats);
+}
+
+/*********************************************************************
+ * The following routines replay a trace as it is read (-S), for
+ * traces too big to load. Memory use is bounded by two chunks of
+ * requests plus a map entry, a slot and a range tree entry per live
+ * block.
+ *********************************************************************/
+
+/*
+ * map_entry - the entry that holds id, or the empty one it would go in
+ */
+static id_slot_t *map_entry(slot_map_t *map, int id)
+{
+    unsigned i = ((unsigned)id * 2654435761u) & map->mask;
+
+    while (map->table[i].id >= 0 && map->table[i].id != id)
+	i = (i + 1) & map->mask;
+    return &map->table[i];
+}
+
+/*
+ * map_resize - rehash the map into a table of n entries
+ */
+static void map_resize(slot_map_t *map, unsigned n)
+{
+    id_slot_t *old = map->table;
+    unsigned i, oldn = old ? map->mask + 1 : 0;
+
+    if ((map->table = (id_slot_t *)malloc(n * sizeof(id_slot_t))) == NULL)
+	unix_error("malloc failed in map_resize");
+    for (i = 0; i < n; i++)
+	map->table[i].id = -1;
+    map->mask = n - 1;
+    for (i = 0; i < oldn; i++)
+	if (old[i].id >= 0)
+	    *map_entry(map, old[i].id) = old[i];
+    free(old);
+}
+
+/*
+ * map_get - the slot of block id, which is given one (the most recently
+ *     freed, if any) if it is not live
+ */
+static int map_get(slot_map_t *map, int id)
+{
+    id_slot_t *e;
+
+    if (2 * (map->count + 1) > map->mask + 1)
+	map_resize(map, 2 * (map->mask + 1));
+    e = map_entry(map, id);
+    if (e->id >= 0)
+	return e->slot;
+    if (map->nfree > 0)
+	e->slot = map->free_slots[--map->nfree];
+    else {
+	if (map->nslots == map->max_slots) {
+	    map->max_slots = map->max_slots ? 2 * map->max_slots : MAP_MIN;
+	    if ((map->free_slots = (int *)realloc(map->free_slots,
+			map->max_slots * sizeof(int))) == NULL)
+		unix_error("realloc failed in map_get");
+	}
+	e->slot = map->nslots++;
+    }
+    e->id = id;
+    map->count++;
+    return e->slot;
+}
+
+/*
+ * map_drop - forget block id and free its slot. Returns the slot, or -1
+ *     if the id is not live. The entries after it in its run of full
+ *     ones move back into the gap if they may, so lookups still find
+ *     them without tombstones.
+ */
+static int map_drop(slot_map_t *map, int id)
+{
+    id_slot_t *e = map_entry(map, id);
+    unsigned i = e - map->table, j, home;
+    int slot = e->slot;
+
+    if (e->id < 0)
+	return -1;
+    for (j = (i + 1) & map->mask; map->table[j].id >= 0;
+	 j = (j + 1) & map->mask) {
+	home = ((unsigned)map->table[j].id * 2654435761u) & map->mask;
+	if (((j - home) & map->mask) >= ((j - i) & map->mask)) {
+	    map->table[i] = map->table[j];
+	    i = j;
+	}
+    }
+    map->table[i].id = -1;
+    map->count--;
+    map->free_slots[map->nfree++] = slot;
+    if (8 * map->count < map->mask + 1 && map->mask + 1 > MAP_MIN)
+	map_resize(map, (map->mask + 1) / 2);
+    return slot;
+}
+
+/*
+ * map_chunk - rename the ids of n requests to slots. A free of an id
+ *     that is not live gets slot -1.
+ */
+static void map_chunk(slot_map_t *map, traceop_t *ops, int n)
+{
+    int k;
+
+    for (k = 0; k < n; k++) {
+	if (ops[k].type == FREE)
+	    ops[k].index = map_drop(map, ops[k].index);
+	else
+	    ops[k].index = map_get(map, ops[k].index);
+    }
+}
+
+/*
+ * prefetch_thread - read chunks into the two buffers in turn, each as
+ *     soon as it has been replayed, until the end of the trace
+ */
+static void *prefetch_thread(void *arg)
+{
+    prefetch_t *pf = (prefetch_t *)arg;
+    int k = 0, n;
+
+    for (;;) {
+	pthread_mutex_lock(&pf->lock);
+	while (pf->full[k] && !pf->stop)
+	    pthread_cond_wait(&pf->cond, &pf->lock);
+	pthread_mutex_unlock(&pf->lock);
+	if (pf->stop)
+	    break;
+
+	n = trace_read(pf->ts, pf->buf[k], STREAM_CHUNK);
+	if (n > 0)
+	    map_chunk(&pf->map, pf->buf[k], n);
+
+	pthread_mutex_lock(&pf->lock);
+	pf->n[k] = n;
+	pf->nslots[k] = pf->map.nslots;
+	pf->full[k] = 1;
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->lock);
+	if (n <= 0)
+	    break;
+	k ^= 1;
+    }
+    return NULL;
+}
+
+/*
+ * prefetch_start - open the trace at path and start reading it ahead
+ */
+static int prefetch_start(prefetch_t *pf, char *path, trace_header_t *hdr)
+{
+    memset(pf, 0, sizeof(*pf));
+    if ((pf->ts = trace_open(path, hdr)) == NULL)
+	return -1;
+    if ((pf->buf[0] = malloc(2 * STREAM_CHUNK * sizeof(traceop_t))) == NULL)
+	unix_error("malloc failed in prefetch_start");
+    pf->buf[1] = pf->buf[0] + STREAM_CHUNK;
+    map_resize(&pf->map, MAP_MIN);
+    pf->cur = -1;
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->cond, NULL);
+    if (pthread_create(&pf->thread, NULL, prefetch_thread, pf) != 0)
+	unix_error("pthread_create failed in prefetch_start");
+    return 0;
+}
+
+/*
+ * prefetch_next - hand back the chunk just replayed and wait for the
+ *     next one. Returns its number of requests, 0 at the end of the
+ *     trace, or -1 if it could not be read; *nslots is the number of
+ *     slots its requests use.
+ */
+static int prefetch_next(prefetch_t *pf, traceop_t **ops, int *nslots)
+{
+    int k, n;
+
+    pthread_mutex_lock(&pf->lock);
+    k = (pf->cur < 0) ? 0 : pf->cur ^ 1;
+    if (pf->cur >= 0) {
+	pf->full[pf->cur] = 0;
+	pthread_cond_broadcast(&pf->cond);
+    }
+    while (!pf->full[k])
+	pthread_cond_wait(&pf->cond, &pf->lock);
+    n = pf->n[k];
+    *nslots = pf->nslots[k];
+    pf->cur = k;
+    pthread_mutex_unlock(&pf->lock);
+    *ops = pf->buf[k];
+    return n;
+}
+
+/*
+ * prefetch_stop - stop the reader and close the trace
+ */
+static void prefetch_stop(prefetch_t *pf)
+{
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = 1;
+    pthread_cond_broadcast(&pf->cond);
+    pthread_mutex_unlock(&pf->lock);
+    pthread_join(pf->thread, NULL);
+    pthread_mutex_destroy(&pf->lock);
+    pthread_cond_destroy(&pf->cond);
+    trace_close(pf->ts);
+    free(pf->buf[0]);
+    free(pf->map.table);
+    free(pf->map.free_slots);
+}
+
+/*
+ * elapsed - CPU seconds this thread has used since *start (so the time
+ *     the reader runs for on the same CPU is left out)
+ */
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (now.tv_sec - start->tv_sec) + 1e-9 * (now.tv_nsec - start->tv_nsec);
+}
+
+/*
+ * replay_stream - run the trace at path through the mm package as it is
+ *     read. With ranges, check every block the way eval_mm_valid does
+ *     and return the utilization in *util (as eval_mm_util would);
+ *     without, just replay it as fast as possible for timing. Either
+ *     way *secs is the time spent in mm_init and the replay loops,
+ *     leaving out the reader and the waits for it. A block id that is not live
+ *     when it is freed or realloc'd stands for a block allocated before
+ *     the trace began: the free is skipped and the realloc becomes a
+ *     malloc. Returns 0 after an error.
+ */
+static int replay_stream(char *path, int tracenum, range_t **ranges,
+			 double *util, double *secs)
+{
+    prefetch_t pf;
+    trace_header_t hdr;
+    traceop_t *ops, *op;
+    block_t *blocks = NULL, *b;
+    struct timespec start;
+    long total_size = 0, max_total_size = 0;
+    int i, j, k, n, nslots, maxslots = 0, slot, size, oldsize, valid = 0;
+    char *p;
+
+    *secs = 0;
+    if (prefetch_start(&pf, path, &hdr) < 0) {
+	sprintf(msg, "Could not read %s in replay_stream", path);
+	app_error(msg);
+    }
+    if (ranges != NULL)
+	clear_ranges(ranges);
+    mem_reset_brk();
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	goto out;
+    }
+    *secs += elapsed(&start);
+
+    for (i = 0; (n = prefetch_next(&pf, &ops, &nslots)) > 0; i += n) {
+	if (nslots > maxslots) {
+	    if ((blocks = (block_t *)realloc(blocks,
+				nslots * sizeof(block_t))) == NULL)
+		unix_error("realloc failed in replay_stream");
+	    memset(blocks + maxslots, 0,
+		   (nslots - maxslots) * sizeof(block_t));
+	    maxslots = nslots;
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	for (k = 0; k < n; k++) {
+	    op = &ops[k];
+	    slot = op->index;
+	    size = op->size;
+	    b = (slot >= 0) ? &blocks[slot] : NULL;
+
+	    switch (op->type) {
+	    case ALLOC:
+	    case MEMALIGN:
+		if (op->type == MEMALIGN)
+		    p = mm_memalign(op->align, size);
+		else
+		    p = mm_malloc(size);
+		if (p == NULL) {
+		    malloc_error(tracenum, i + k, "mm_malloc failed.");
+		    goto out;
+		}
+		if (ranges != NULL) {
+		    if (op->type == MEMALIGN &&
+			(unsigned long)p % op->align != 0) {
+			malloc_error(tracenum, i + k,
+				     "mm_memalign returned a misaligned block.");
+			goto out;
+		    }
+		    if (add_range(ranges, p, size, tracenum, i + k) == 0)
+			goto out;
+		    memset(p, slot & 0xFF, size);
+		    /* a live id reused: its old block leaks */
+		    total_size += size - (b->p ? b->size : 0);
+		}
+		b->p = p;
+		b->size = size;
+		break;
+
+	    case REALLOC:
+		if ((p = mm_realloc(b->p, size)) == NULL) {
+		    malloc_error(tracenum, i + k, "mm_realloc failed.");
+		    goto out;
+		}
+		if (ranges != NULL) {
+		    oldsize = b->p ? b->size : 0;
+		    if (b->p != NULL)
+			remove_range(ranges, b->p);
+		    if (add_range(ranges, p, size, tracenum, i + k) == 0)
+			goto out;
+		    total_size += size - oldsize;
+		    if (size < oldsize)
+			oldsize = size;
+		    for (j = 0; j < oldsize; j++) {
+			if ((unsigned char)p[j] != (slot & 0xFF)) {
+			    malloc_error(tracenum, i + k, "mm_realloc did not "
+					 "preserve the data from old block");
+			    goto out;
+			}
+		    }
+		    memset(p, slot & 0xFF, size);
+		}
+		b->p = p;
+		b->size = size;
+		break;
+
+	    case FREE:
+		if (slot < 0)
+		    break;
+		if (ranges != NULL) {
+		    remove_range(ranges, b->p);
+		    total_size -= b->size;
+		}
+		mm_free(b->p);
+		b->p = NULL;
+		break;
+	    }
+
+	    if (ranges != NULL) {
+		if (total_size > max_total_size)
+		    max_total_size = total_size;
+		if (check_every && (i + k + 1) % check_every == 0 &&
+		    !mm_check()) {
+		    malloc_error(tracenum, i + k,
+				 "mm_check found an inconsistent heap.");
+		    goto out;
+		}
+	    }
+	}
+	*secs += elapsed(&start);
+    }
+    if (n < 0)
+	app_error("Could not read the trace in replay_stream");
+    valid = 1;
+    if (util != NULL)
+	*util = (double)max_total_size / (double)mem_peaksize();
+
+ out:
+    prefetch_stop(&pf);
+    free(blocks);
+    return valid;
+}
+
+/*
+ * eval_mm_stream - Check the mm malloc package for correctness on the
+ *     trace at path and measure its utilization, in one streamed pass
+ */
+static int eval_mm_stream(char *path, int tracenum, range_t **ranges,
+			  stats_t *stats)
+{
+    trace_stream_t *ts;
+    trace_header_t hdr;
+    double secs;
+
+    if ((ts = trace_open(path, &hdr)) == NULL) {
+	sprintf(msg, "Could not read %s in eval_mm_stream", path);
+	app_error(msg);
+    }
+    trace_close(ts);
+    stats->ops = hdr.num_ops;
+    return replay_stream(path, tracenum, ranges, &stats->util, &secs);
+}
+
+/*
+ * eval_mm_stream_speed - time a streamed replay of the trace at path.
+ *     Only the calls to the mm package are timed, not reading the
+ *     trace; one that does not fit in memory is read once per run, so
+ *     it is run only once.
+ */
+static double eval_mm_stream_speed(char *path)
+{
+    double secs;
+
+    if (!replay_stream(path, 0, NULL, NULL, &secs))
+	app_error("mm_malloc failed in eval_mm_stream_speed");
+    return secs;
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
 
 
+/*
+ * printallocstats - prints the counters mm.c kept during the utilization
+ *     run of a trace (it must be built with -DMM_STATS)
+ */
+static void printallocstats(int tracenum, char *tracefile)
+{
+    mm_stats_t st;
+    int i;
+
+    if (mm_stats(&st) < 0) {
+	printf("No allocator statistics for trace %d: build mm.c with -DMM_STATS\n",
+	       tracenum);
+	return;
+    }
+    printf("\nAllocator statistics for trace %d (%s):\n", tracenum, tracefile);
+    printf("  calls     malloc %lu, free %lu, realloc %lu, calloc %lu, memalign %lu\n",
+	   st.malloc_calls, st.free_calls, st.realloc_calls, st.calloc_calls,
+	   st.memalign_calls);
+    printf("  find_fit  %lu searches, %lu lists, %lu blocks probed (%.2f per search)\n",
+	   st.fit_searches, st.fit_groups, st.fit_probes,
+	   st.fit_searches ? (double)st.fit_probes / st.fit_searches : 0.0);
+    printf("  place     %lu splits\n", st.splits);
+    printf("  coalesce  case 1: %lu, case 2: %lu, case 3: %lu, case 4: %lu\n",
+	   st.coalesce[0], st.coalesce[1], st.coalesce[2], st.coalesce[3]);
+    printf("  extend    %lu calls, %lu bytes\n", st.extends, st.extend_bytes);
+    printf("  realloc   %lu in place, %lu copied\n", st.realloc_inplace,
+	   st.realloc_copy);
+    printf("  free lists (blocks of at least N bytes: count)\n   ");
+    for (i = 0; i < MM_STATS_CLASSES; i++)
+	if (st.free_blocks[i])
+	    printf(" %lu: %lu", 16UL << i, st.free_blocks[i]);
+    printf("\n");
+}
+
 /*
  * printresults - prints a performance summary for some malloc package
  */
@@ -997,14 +1820,21 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValsSIT] [-f <file>] [-t <dir>] [-c <n>] [-H <mb>] [-j <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-c <n>     Run mm_check every <n> operations.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <mb>    Reserve <mb> MB for the heap (default %d).\n", MAX_HEAP >> 20);
+    fprintf(stderr, "\t-I         With -j, time the traces one at a time.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to <n> traces at once, in worker processes.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-s         Print allocator statistics (mm.c built with -DMM_STATS).\n");
+    fprintf(stderr, "\t-S         Stream the traces instead of loading them.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T         Put the heap on transparent huge pages.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -2,7 +2,24 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            Besides the sbrk-style heap, it hands out separate mappings
+ *            (mem_map/mem_unmap/mem_remap) for large blocks. They are kept
+ *            in a list so that mem_reset_brk can drop them, and counted in
+ *            the peak footprint (mem_peaksize) the driver measures.
+ *
+ *            The heap is a range of address space reserved up front
+ *            (PROT_NONE, MAP_NORESERVE) and committed in MEM_COMMIT steps
+ *            as mem_sbrk advances, so a large heap costs nothing until it
+ *            is used. Its size is MEM_HEAP unless mem_set_maxheap picks
+ *            another before mem_init. The module never calls libc malloc
+ *            (the LD_PRELOAD build replaces it).
+ *
+ *            With mem_set_hugepages, the heap starts on a MEM_HUGE boundary
+ *            and is madvise'd MADV_HUGEPAGE, so the kernel can back it with
+ *            transparent huge pages; it is then committed in MEM_HUGE steps.
  */
+#define _GNU_SOURCE /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,24 +31,92 @@
 #include "memlib.h"
 #include "config.h"
 
+#ifndef MEM_HEAP
+#define MEM_HEAP MAX_HEAP /* default bytes reserved for the heap */
+#endif
+#define MEM_COMMIT (64*1024) /* the heap is made accessible in steps of this many bytes */
+#define MEM_HUGE (2*1024*1024) /* transparent huge page size */
+
+/* header at the start of every mapping handed out by mem_map */
+typedef struct mem_mapping {
+    struct mem_mapping *next; /* next mapping in the list */
+    struct mem_mapping *prev; /* previous mapping in the list */
+    size_t len;               /* length of the whole mapping in bytes */
+    size_t pad;               /* keeps the usable area 16-byte aligned */
+} mem_mapping_t;
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_commit;     /* heap storage below this is accessible */
+static size_t mem_reserve = MEM_HEAP; /* bytes reserved by mem_init */
+static int mem_want_huge = 0;  /* set by mem_set_hugepages */
+static size_t mem_huge = 0;    /* MEM_HUGE if the heap is on huge pages, else 0 */
+static mem_mapping_t *mem_maps = NULL; /* mappings handed out by mem_map */
+static size_t mem_mapped = 0;  /* total bytes in those mappings */
+static size_t mem_peak = 0;    /* peak of heap size plus mapped bytes */
+static char *mem_dirty;        /* heap bytes from here up have never been written */
+
+static void mem_unmap_all(void);
+static void mem_release(char *lo, char *hi);
+static int mem_commit_to(char *hi);
+static void mem_update_peak(void);
+
+/*
+ * mem_set_maxheap - set the number of bytes the next mem_init reserves
+ *    for the heap (rounded up to whole pages)
+ */
+void mem_set_maxheap(size_t size)
+{
+    mem_reserve = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+}
+
+/*
+ * mem_set_hugepages - ask the next mem_init to put the heap on
+ *    transparent huge pages (on is nonzero) or not
+ */
+void mem_set_hugepages(int on)
+{
+    mem_want_huge = on;
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    size_t slack = 0;
+    char *p;
+
+    /* reserve the address space we will use to model the available VM */
+    /* (it reads as zero once committed, like the fresh pages sbrk hands out) */
+    if (mem_want_huge) { /* over-reserve, so a MEM_HUGE boundary lies within */
+	mem_reserve = (mem_reserve + MEM_HUGE - 1) & ~(size_t)(MEM_HUGE - 1);
+	slack = MEM_HUGE;
+    }
+    p = mmap(NULL, mem_reserve + slack, PROT_NONE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
+    mem_start_brk = p;
+    mem_huge = 0;
+    if (mem_want_huge) { /* give back the slack around the aligned heap */
+	mem_start_brk = (char *)(((unsigned long)p + MEM_HUGE - 1) & ~(unsigned long)(MEM_HUGE - 1));
+	if (mem_start_brk > p)
+	    munmap(p, mem_start_brk - p);
+	if (mem_start_brk < p + slack)
+	    munmap(mem_start_brk + mem_reserve, p + slack - mem_start_brk);
+	if (madvise(mem_start_brk, mem_reserve, MADV_HUGEPAGE) == 0)
+	    mem_huge = MEM_HUGE; /* (the kernel may have THP disabled) */
+    }
     
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_max_addr = mem_start_brk + mem_reserve; /* max legal heap address */
+    mem_brk = mem_start_brk;                    /* heap is empty initially */
+    mem_commit = mem_start_brk;                 /* nothing committed yet */
+    mem_dirty = mem_start_brk;
 }
 
 /* 
@@ -39,7 +124,8 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_unmap_all();
+    munmap(mem_start_brk, mem_reserve);
 }
 
 /*
@@ -48,23 +134,39 @@ void mem_deinit(void)
 void mem_reset_brk()
 {
     mem_brk = mem_start_brk;
+    mem_unmap_all();
+    mem_peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area.
+ *    A negative incr shrinks the heap; the whole pages it gives up
+ *    are handed back to the system (their contents are lost).
  */
 void *mem_sbrk(int incr) 
 {
     char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if (incr < 0) {
+	if (mem_brk + incr < mem_start_brk) {
+	    errno = EINVAL;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap start...\n");
+	    return (void *)-1;
+	}
+	mem_brk += incr;
+	mem_release(mem_brk, old_brk);
+	return (void *)old_brk;
+    }
+    if ((mem_brk + incr) > mem_max_addr || mem_commit_to(mem_brk + incr) < 0) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
     mem_brk += incr;
+    if (mem_brk > mem_dirty)
+	mem_dirty = mem_brk;
+    mem_update_peak();
     return (void *)old_brk;
 }
 
@@ -84,6 +186,25 @@ void *mem_heap_hi()
     return (void *)(mem_brk - 1);
 }
 
+/*
+ * mem_heap_dirty - return the address from which the heap storage is
+ *    known to be zero (it has never been inside the brk, or has been
+ *    given back to the system since)
+ */
+void *mem_heap_dirty()
+{
+    return (void *)mem_dirty;
+}
+
+/*
+ * mem_hugepagesize() - returns the huge page size if the heap is on
+ *    huge pages, else 0
+ */
+size_t mem_hugepagesize()
+{
+    return mem_huge;
+}
+
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
@@ -99,3 +220,172 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_map - map a region of at least size bytes outside the heap and
+ *    return its first usable (16-byte aligned) address, or NULL if the
+ *    system refuses.
+ */
+void *mem_map(size_t size)
+{
+    size_t len = size + sizeof(mem_mapping_t);
+    mem_mapping_t *m;
+
+    len = (len + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    m->len = len;
+    m->prev = NULL;
+    m->next = mem_maps;
+    if (mem_maps)
+	mem_maps->prev = m;
+    mem_maps = m;
+    mem_mapped += len;
+    mem_update_peak();
+    return (void *)(m + 1);
+}
+
+/*
+ * mem_unmap - give a region returned by mem_map/mem_remap back to the system
+ */
+void mem_unmap(void *ptr)
+{
+    mem_mapping_t *m = (mem_mapping_t *)ptr - 1;
+
+    if (m->prev)
+	m->prev->next = m->next;
+    else
+	mem_maps = m->next;
+    if (m->next)
+	m->next->prev = m->prev;
+    mem_mapped -= m->len;
+    munmap(m, m->len);
+}
+
+/*
+ * mem_remap - resize a region returned by mem_map to at least size bytes,
+ *    moving it if the system cannot grow it in place (the contents go
+ *    along without copying). Returns the new usable address, or NULL
+ *    (leaving the old region intact) on failure.
+ */
+void *mem_remap(void *ptr, size_t size)
+{
+    mem_mapping_t *m = (mem_mapping_t *)ptr - 1;
+    size_t len = size + sizeof(mem_mapping_t);
+    mem_mapping_t *nm;
+
+    len = (len + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    if (len == m->len)
+	return ptr;
+    nm = mremap(m, m->len, len, MREMAP_MAYMOVE);
+    if (nm == MAP_FAILED) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    /* the links moved along with the mapping; fix up the neighbours */
+    if (nm->prev)
+	nm->prev->next = nm;
+    else
+	mem_maps = nm;
+    if (nm->next)
+	nm->next->prev = nm;
+    mem_mapped += len - nm->len;
+    nm->len = len;
+    mem_update_peak();
+    return (void *)(nm + 1);
+}
+
+/*
+ * mem_is_mapped - does [lo, hi] lie within the usable part of one mapping?
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    mem_mapping_t *m;
+
+    for (m = mem_maps; m != NULL; m = m->next)
+	if ((char *)lo >= (char *)(m + 1) && (char *)hi < (char *)m + m->len)
+	    return 1;
+    return 0;
+}
+
+/*
+ * mem_mapsize() - returns the number of bytes in mappings
+ */
+size_t mem_mapsize()
+{
+    return mem_mapped;
+}
+
+/*
+ * mem_peaksize() - returns the peak of the heap size plus the mapped
+ *    bytes since the last mem_reset_brk
+ */
+size_t mem_peaksize()
+{
+    return mem_peak;
+}
+
+/*
+ * mem_unmap_all - drop every mapping that is still around
+ */
+static void mem_unmap_all(void)
+{
+    while (mem_maps != NULL)
+	mem_unmap(mem_maps + 1);
+}
+
+/*
+ * mem_release - give the whole pages within [lo, hi) back to the system.
+ *    When it can, it also takes the dirty pages above hi along, so the
+ *    storage from the first released page up reads as zero again.
+ */
+static void mem_release(char *lo, char *hi)
+{
+    unsigned long mask = mem_pagesize() - 1;
+    char *start = (char *)(((unsigned long)lo + mask) & ~mask);
+    char *end = (char *)(((unsigned long)mem_dirty + mask) & ~mask);
+
+    if (end <= mem_max_addr) {
+	if (start < end && madvise(start, end - start, MADV_DONTNEED) == 0)
+	    mem_dirty = start;
+	return;
+    }
+    end = (char *)((unsigned long)hi & ~mask);
+    if (start < end)
+	madvise(start, end - start, MADV_DONTNEED);
+}
+
+/*
+ * mem_commit_to - make the heap storage below hi accessible, committing
+ *    MEM_COMMIT (or, on huge pages, MEM_HUGE) bytes at a time. Returns -1
+ *    if the system refuses.
+ */
+static int mem_commit_to(char *hi)
+{
+    size_t step = mem_huge ? mem_huge : MEM_COMMIT;
+    char *end;
+
+    if (hi <= mem_commit)
+	return 0;
+    end = mem_commit + (hi - mem_commit + step - 1) / step * step;
+    if (end > mem_max_addr)
+	end = mem_max_addr;
+    if (mprotect(mem_commit, end - mem_commit, PROT_READ | PROT_WRITE) < 0)
+	return -1;
+    mem_commit = end;
+    return 0;
+}
+
+/*
+ * mem_update_peak - account the current footprint in the peak
+ */
+static void mem_update_peak(void)
+{
+    size_t footprint = mem_heapsize() + mem_mapped;
+
+    if (footprint > mem_peak)
+	mem_peak = footprint;
+}
@@ -1,11 +1,22 @@
 #include <unistd.h>
 
+void mem_set_maxheap(size_t size);
+void mem_set_hugepages(int on);
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_heap_dirty(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+size_t mem_hugepagesize(void);
+
+void *mem_map(size_t size);
+void mem_unmap(void *ptr);
+void *mem_remap(void *ptr, size_t size);
+int mem_is_mapped(void *lo, void *hi);
+size_t mem_mapsize(void);
+size_t mem_peaksize(void);
 
@@ -3,10 +3,17 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
 
 #include "mm.h"
 #include "memlib.h"
 
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
+
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
  * provide your team information in the following struct.
@@ -20,11 +27,17 @@ team_t team = {
     "jlee4923@naver.com",
 };
 
-/* single word (4) or double word (8) alignment */
+/* double word (8) alignment, or MM_ALIGNMENT bytes (libmm.so is built with
+   -DMM_ALIGNMENT=16, the alignment of libc malloc on 64-bit) : block sizes, slab
+   classes and bins are multiples of it */
+#ifdef MM_ALIGNMENT
+#define ALIGNMENT MM_ALIGNMENT
+#else
 #define ALIGNMENT 8
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
@@ -35,6 +48,20 @@ team_t team = {
 #define MAX(x, y) ((x) > (y)? (x): (y))
 #define MIN(x, y) ((x) > (y)? (y): (x))
 
+// when set, allocated blocks carry only a header and the header records whether
+// the previous block is allocated (bit 1). only free blocks keep a footer.
+#define ELIDE_FOOTERS 1
+
+#if ELIDE_FOOTERS
+#define ALLOC_OVERHEAD WSIZE // header only
+#else
+#define ALLOC_OVERHEAD DSIZE // header and footer
+#endif
+#define MIN_BLOCK (2*DSIZE) // header, prev/next links and footer of a free block
+
+// adjusted block size for a payload of size bytes (includes overhead, ALIGNMENT-aligned)
+#define ADJUST_SIZE(size) (MAX(ALIGN((size) + ALLOC_OVERHEAD), MIN_BLOCK))
+
 // pack a size and allocated bit into a word      
 #define PACK(size, alloc) ((size) | (alloc))
 
@@ -45,6 +72,8 @@ team_t team = {
 // read the size/allocated info from p
 #define GET_SIZE(p) (GET(p) & ~0x7) // Size bits
 #define GET_ALLOC(p) (GET(p) & 0x1) // LSB for checking allocation
+#define PREV_ALLOC 0x2 // header bit set when the previous block is allocated
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
 
 // given block pointer, compute addresses of header/footer
 #define HDRP(bp) ((char *) (bp) - WSIZE)
@@ -56,93 +85,433 @@ team_t team = {
 #define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)))
 
-// given block pointer, compute addresses of previous/next FREE block pointers
-#define FREE_PREV_BLKP(bp) ((char *) GET(FREE_PREV(bp)))
-#define FREE_NEXT_BLKP(bp) ((char *) GET(FREE_NEXT(bp)))
+// write the header of bp, keeping its prev-allocated bit (PREV_BLKP is only valid when that bit is clear)
+#define PUT_HDR(bp, size, alloc) PUT(HDRP(bp), PACK(size, alloc) | GET_PREV_ALLOC(HDRP(bp)))
+#if ELIDE_FOOTERS
+#define PUT_ALLOC_FTR(bp, size) // allocated blocks have no footer
+#else
+#define PUT_ALLOC_FTR(bp, size) PUT(FTRP(bp), PACK(size, 1))
+#endif
+
+// set/clear the prev-allocated bit in the header of bp
+#define SET_PREV_ALLOC(bp) PUT(HDRP(bp), GET(HDRP(bp)) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(bp) PUT(HDRP(bp), GET(HDRP(bp)) & ~PREV_ALLOC)
+
+// free-list links and seglist heads are single words.
+// on a 32-bit build a link is the address itself; on a 64-bit build it is the
+// offset of the address from the start of the heap, so the block layout (4 B
+// header, 16 B minimum block) is the same on both. offset 0 is the first seglist
+// head and never a free block, so a zero link still means "no block".
+#if defined(__LP64__) || defined(_WIN64)
+#define OFFSET_LINKS 1
+#define LINK_ENC(ptr) ((unsigned int) ((char *) (ptr) - heap_base))
+#define LINK_DEC(val) (heap_base + (val))
+#else
+#define OFFSET_LINKS 0
+#define LINK_ENC(ptr) ((unsigned int) (ptr))
+#define LINK_DEC(val) ((char *) (val))
+#endif
+
+// read/write a link word at address p (GET_LINK decodes a zero word as NULL)
+#define GET_LINK(p) (GET(p) ? LINK_DEC(GET(p)) : NULL)
+#define PUT_LINK(p, ptr) PUT(p, LINK_ENC(ptr))
 
+// given block pointer, compute addresses of previous/next FREE block pointers
+// (the prev link of the first block in a list points to the seglist head, which may be at offset 0)
+#define FREE_PREV_BLKP(bp) (LINK_DEC(GET(FREE_PREV(bp))))
+#define FREE_NEXT_BLKP(bp) (GET_LINK(FREE_NEXT(bp)))
+
+// the seglist is a two-level segregated-fit (TLSF) index.
+// first level (fl) : power-of-two class, fl = floor(log2(size)) - FL_MIN
+// second level (sl) : SL_COUNT linear subdivisions of each power-of-two range
+// a size group is non-empty iff its bit is set in sl_bitmap[fl] (and fl's bit in fl_bitmap),
+// so the group for any size is found with clz/ffs instead of walking the lists.
+#define SL_SHIFT 2
+#define SL_COUNT (1 << SL_SHIFT) // second-level subdivisions per power of two
+#define FL_MIN 4 // the first class starts at the minimum block (16 B)
+#define FL_COUNT (32 - FL_MIN) // block sizes fit in the 32-bit header
+#define SEGLIST_SIZE (FL_COUNT * SL_COUNT) // the number of size groups in the seglist
+#define SEG_HEAD(i) (seg_listp + (i)*WSIZE) // address of the head word of size group i
+
+// good-fit policy : find_fit examines up to FIT_SCAN blocks of a size group and takes
+// the tightest one that fits (1 = first fit; larger values trade speed for utilization)
+#ifndef FIT_SCAN
+#define FIT_SCAN 8 // e.g. MMFLAGS=-DFIT_SCAN=4
+#endif
+
+// slab layer : requests of up to SLAB_MAX bytes are carved from RUN_SIZE-aligned runs, one
+// object size (class) per run, with no per-object header. a run is an ordinary allocated
+// block of the heap; its slab_run_t header sits at the (aligned) block pointer and tracks
+// free slots in a bitmap. mm_free tells slab objects apart through slab_map, one bit per
+// RUN_SIZE of address space, so the run of an object is found from its address alone.
+#define SLAB_MAX 64 // largest request served by the slab layer (0 disables it)
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT) // one class per ALIGNMENT bytes of object size
+#define RUN_SHIFT 12
+#define RUN_SIZE (1 << RUN_SHIFT) // block size (and alignment) of a slab run
+#define RUN_SLOTS (RUN_SIZE / ALIGNMENT) // upper bound of objects per run
+#define MAX_RUNS (1UL << (32 - RUN_SHIFT)) // the heap spans at most 4 GB (32-bit sizes and links)
+
+typedef struct slab_run {
+#ifdef MM_THREADS
+    struct thread_cache *owner; // the only thread cache that allocates from (and frees to) the run
+#endif
+    struct slab_run *next; // next run of the class with a free slot
+    struct slab_run *prev; // previous run of the class with a free slot
+    unsigned int objsize; // object size of the class
+    unsigned int nslots; // number of objects in the run
+    unsigned int nfree; // number of free objects
+    unsigned int free_map[RUN_SLOTS / 32]; // bit i set : slot i is free
+} slab_run_t;
+
+#define RUN_HDR_SIZE (ALIGN(sizeof(slab_run_t)))
+#define RUN_OBJS(run) ((char *) (run) + RUN_HDR_SIZE) // first object of a run
+#define RUN_OF(p) ((slab_run_t *) ((unsigned long) (p) & ~(unsigned long) (RUN_SIZE - 1)))
+#define RUN_INDEX(p) (((unsigned long) (p) >> RUN_SHIFT) - ((unsigned long) heap_base >> RUN_SHIFT))
+#define IS_SLAB(p) ((char *) (p) >= heap_base && RUN_INDEX(p) < MAX_RUNS && \
+                    (slab_map[RUN_INDEX(p) / 32] & (1U << (RUN_INDEX(p) % 32))))
+
+// heap trimming : when a free block next to the epilogue reaches TRIM_THRESHOLD bytes,
+// the heap is shrunk (mem_sbrk with a negative increment) down to TRIM_KEEP bytes of
+// that block, so the heap follows the live data instead of staying at its peak.
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (128 * 1024) // e.g. MMFLAGS=-DTRIM_THRESHOLD=65536
+#endif
+#define TRIM_KEEP CHUNKSIZE // left at the top so the next requests need not extend the heap
+// when memlib puts the heap on huge pages (mem_hugepagesize), extend_heap and trim_heap
+// keep the end of the heap on a huge page boundary (heap_grain), so no huge page is split.
+
+// fast bins : freed blocks of up to FASTBIN_MAX bytes go onto exact-size LIFO lists
+// without coalescing, and a malloc of the same size pops them back. the blocks stay
+// marked allocated while binned (so no neighbour merges with them), the link to the
+// next one sits in the payload. fastbin_consolidate frees them all for real when the
+// seglist misses, before the heap is extended.
+#define FASTBIN_MAX 256 // largest block size kept in the fast bins
+#define FASTBINS (FASTBIN_MAX / ALIGNMENT + 1) // one bin per ALIGNMENT bytes of block size
+#define FB_INDEX(asize) ((asize) / ALIGNMENT)
+
+// realloc growth reservation : reserve_table remembers the blocks mm_realloc has grown.
+// when one grows again, it gets headroom behind it (half its size), so a buffer grown
+// step by step is copied O(log n) times and the next growth requests are met in place.
+// the headroom is limited by memory pressure, not by a fixed size : it goes back to the
+// heap when the block shrinks below its last request, when its slot is taken over by
+// another block, and before the heap is extended if the block has not grown since the
+// last extension (it stopped growing). all of it is released when the heap cannot be
+// extended, and a block that cannot get its headroom grows without it. blocks
+// that move to a mapping get none (mem_remap grows those). blocks under RESERVE_MIN
+// bytes are not tracked (which keeps tracked blocks out of the thread caches of MM_THREADS).
+#define RESERVE_SLOTS 8 // growing blocks tracked at once
+#define RESERVE_MIN 512
+#define HEADROOM(asize) ((asize) < MAP_MAX / 2 ? ALIGN((asize) / 2) : 0)
+
+typedef struct {
+    char *bp; // the growing block (NULL : unused slot)
+    size_t size; // the block size its last realloc asked for; the rest of the block is headroom
+    unsigned int gen; // extend_gen when it last grew
+} reserve_t;
+
+// zeroing elision : memlib storage that was never inside the brk reads as zero
+// (mem_heap_dirty), and heap_clean marks the end of the blocks ever handed out. a block
+// at or above heap_clean has been part of the top free block only, so mm_calloc need
+// clear just the tags that block had (links and footer), not the whole payload. (when
+// extend_heap merges the new space with the top block, it clears the tags in between.)
+#define MARK_USED(next) do { if ((char *) (next) > heap_clean) heap_clean = (char *) (next); } while (0)
+
+// large blocks : requests of at least MMAP_THRESHOLD bytes get a mapping of their own
+// (mem_map) instead of a heap block, so freeing one returns the memory at once and
+// realloc resizes it with mem_remap (mremap) without copying. the block pointer sits
+// MAP_HDR into the mapping, which mem_map aligns to 16 bytes, so a mapped block has the
+// alignment libc malloc gives on 64-bit too. its header holds the mapping length with
+// the MMAPPED bit set.
+#define MMAP_THRESHOLD (128 * 1024)
+#define MMAPPED 0x4 // header bit of a mapped block
+#define MAP_MAX (0xffffffffUL & ~(ALIGNMENT - 1UL)) // largest mapping length that fits the header
+#define IS_MMAPPED(bp) (GET(HDRP(bp)) & MMAPPED)
+#define MAP_HDR MAX(2 * sizeof(void *), ALIGNMENT) // bytes of a mapping before the block pointer
+#define MAP_BASE(bp) ((char *) (bp) - MAP_HDR) // start of the mapping of a mapped block
+
+// thread-safe build (MM_THREADS) : one lock guards the heap and the seglist.
+// each thread has a thread cache that
+//  - keeps recently freed small blocks in exact-size bins (tcache), so most malloc/free
+//    pairs on one thread never take the lock;
+//  - owns the slab runs it allocates from, so slab objects are taken and returned
+//    without the lock by the owning thread;
+//  - has a lock-free MPSC stack (remote_frees) on which other threads push the objects
+//    of its runs they free (one CAS each). the owner drains the whole stack at once.
+// a thread cache is allocated from the heap. when its thread exits, the cached blocks go
+// back to the heap and the cache (with its runs) is handed to the next new thread.
+#ifdef MM_THREADS
+#define TCACHE_MAX 256 // largest block size kept in the tcache bins
+#define TCACHE_BINS (TCACHE_MAX / ALIGNMENT) // one bin per ALIGNMENT bytes of block size
+#define TCACHE_FILL 16 // blocks held per bin before frees go to the heap again
+#define TC_INDEX(asize) ((asize) / ALIGNMENT) // bin of an adjusted block size (above SLAB_MAX)
+
+typedef struct thread_cache {
+    unsigned int counts[TCACHE_BINS + 1]; // blocks per bin
+    void *bins[TCACHE_BINS + 1]; // singly linked through the first word of each block
+    slab_run_t *slab_partial[SLAB_CLASSES + 1]; // per class, the runs of this cache with a free slot
+    struct thread_cache *next_orphan; // next cache in orphan_caches (its thread exited)
+    char pad[64]; // keeps remote_frees off the cache lines the owner works on
+    void *remote_frees; // objects of our runs freed by other threads, linked through their first word
+} thread_cache_t;
+
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread thread_cache_t *my_cache; // the calling thread's cache
+static __thread unsigned int my_gen; // heap_gen when my_cache was set up
+static unsigned int heap_gen = 0; // bumped by mm_init; caches of an older heap are gone
+static thread_cache_t *orphan_caches = NULL; // caches of exited threads, waiting to be adopted
+static pthread_key_t tcache_key; // its destructor retires the cache of an exiting thread
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+#define LOCK() pthread_mutex_lock(&mm_lock)
+#define UNLOCK() pthread_mutex_unlock(&mm_lock)
+#define SLAB_PARTIAL (my_cache->slab_partial) // the slab runs of the calling thread
+// block size read without the lock : a neighbour may flip the prev-allocated bit meanwhile, the size bits stay put
+#define HDR_SIZE(bp) (__atomic_load_n((unsigned int *) HDRP(bp), __ATOMIC_RELAXED) & ~0x7)
+#else
+#define LOCK()
+#define UNLOCK()
+#define SLAB_PARTIAL slab_partial
+#define HDR_SIZE(bp) GET_SIZE(HDRP(bp))
+#endif
+
+// statistics (MM_STATS builds only) : counters in stats, which mm_stats copies out.
+// some are bumped outside the lock, hence the atomic add.
+#ifdef MM_STATS
+#define STAT_ADD(field, n) __atomic_fetch_add(&stats.field, (n), __ATOMIC_RELAXED)
+#else
+#define STAT_ADD(field, n)
+#endif
+#define STAT_INC(field) STAT_ADD(field, 1)
+
+static char *heap_base = 0; // first byte of the heap (mem_heap_lo), base of the offset links
+static char *heap_clean = 0; // blocks from here up were never allocated : zero but for their free-block tags
+static size_t heap_grain = 0; // the heap grows and shrinks in multiples of this (0 : any multiple of ALIGNMENT)
 static char *heap_listp = 0; // first block pointer of the heap (prologue block)
-static char **seg_listp = 0; // pointer for the seglist each entry containing the address value of free blocks of specific sizes.
+static char *seg_listp = 0; // pointer for the seglist, each head word containing the link to the first free block of specific sizes.
+static unsigned int fl_bitmap = 0; // bit fl set : some size group of first-level class fl is non-empty
+static unsigned int sl_bitmap[FL_COUNT]; // bit sl of entry fl set : size group (fl, sl) is non-empty
+#ifndef MM_THREADS
+static slab_run_t *slab_partial[SLAB_CLASSES + 1]; // per class, the runs that have a free slot
+#endif
+static unsigned int slab_map[MAX_RUNS / 32]; // bit i set : the i-th RUN_SIZE of the heap is a slab run
+static void *fastbins[FASTBINS]; // bin i : freed blocks of i*ALIGNMENT bytes, linked through their payload
+static int fastbin_used = 0; // some fast bin is non-empty
+static reserve_t reserve_table[RESERVE_SLOTS]; // blocks that mm_realloc has grown
+static int reserve_next = 0; // slot to take over when the table is full (round robin)
+static unsigned int extend_gen = 0; // bumped by every heap extension
+static unsigned long slab_map_top = 0; // one past the highest run index ever set (bound for clearing)
+#ifdef MM_STATS
+static mm_stats_t stats; // cleared by mm_init
+#endif
+
+#define CHECK_REPORTS 10 // problems mm_check prints before it goes quiet
+static uint64_t *check_map = NULL; // mm_check : bit i set : the block at heap_base + 8*i is in a free list
+#define CHECK_BIT(off) ((uint64_t) 1 << ((off) % 64)) // bit of offset off in check_map[(off) / 64]
+static size_t check_words = 0; // length of check_map in words
+static int check_errors; // problems found by the current mm_check
 
 static void *extend_heap(size_t words);
+static void trim_heap(void *bp);
 static void *coalesce(void *bp);
 static void *find_fit(size_t req_size);
 static void place(void *bp, size_t asize);
 static void seg_insert_freeblock(void* bp);
 static void seg_remove_freeblock(void* bp);
-
-int mm_check()
+static int seg_index(size_t size);
+static void *best_in_group(char *bp, size_t req_size);
+static void *malloc_block(size_t asize);
+static void free_block(void *bp);
+static void *alloc_aligned_block(size_t asize, size_t align);
+static void *slab_alloc(size_t size);
+static slab_run_t *slab_free(void *p);
+static void slab_release(slab_run_t *run);
+static void slab_put(void *p, int locked);
+static void *map_block(size_t size);
+static void *remap_block(void *bp, size_t size);
+static void *do_malloc(size_t size);
+static void do_free(void *bp);
+static void *do_realloc(void *ptr, size_t size);
+static void *do_memalign(size_t alignment, size_t size);
+static void *do_calloc(size_t size);
+static size_t carve_blocks(size_t asize, size_t n, void **out);
+static int ptr_cmp(const void *a, const void *b);
+static void realloc_split(void *bp, size_t csize, size_t asize);
+static reserve_t *reserve_find(void *bp);
+static void reserve_drop(void *bp);
+static void *reserve_note(reserve_t *res, void *bp, size_t asize);
+static int reserve_trim(reserve_t *res);
+static int reserve_release(int stale);
+static void fastbin_put(void *bp, size_t size);
+static int fastbin_consolidate(void);
+static void check_error(void *bp, const char *fmt, ...);
+static int check_bounds(char *bp);
+static size_t check_lists(void);
+static size_t check_blocks(void);
+#ifdef MM_THREADS
+static thread_cache_t *tcache_get(void);
+static int tcache_put(thread_cache_t *tc, void *bp, size_t size);
+static void tcache_flush(void *arg);
+static void tcache_key_init(void);
+static void remote_free(thread_cache_t *owner, void *p);
+static void slab_drain(thread_cache_t *tc);
+#endif
+
+/* Description of int mm_check(void)
+ * checks the heap in time linear in its size : a pass over the free lists marks every
+ * listed block in a bitmap (one bit per 8 bytes of heap), then one sweep over the heap
+ * checks each block and that the free ones are exactly the marked ones. prints nothing
+ * unless it finds a problem. returns 1 if the heap is consistent, 0 otherwise.
+ */
+int mm_check(void)
 {
-	int seglist_maxsize = 16; //the maximum index of the seglist.
-	int is_marked_as_free = 1;
-	int is_all_valid = 1;
-	//int overlaps = 0; 
-
-	//Is every block in the freelist (seglist) marked as free?
-	//Also, are they valid?
-	void *size_group; //current size group in traversal.
-	void *bp; //block pointer for the current block in traversal.
-	printf("Seg Freelist Checking Process..\n");
-	for (int i = 0; i < seglist_maxsize; i++) {
-		size_group = seg_listp + i;
-		if (GET(size_group)) { //if the list header is not empty
-			bp = (void *) GET(size_group); //type-cast to void *
-			for (; bp!=NULL; bp = FREE_NEXT(bp)) {
-				//check if the free block is marked as free.
-				if (GET_ALLOC(HDRP(bp)) != 0) {
-					printf("block %p in size group %d is not marked as a free block\n", bp, i);
-					is_marked_as_free = 0; //unset the flag
-				}
-				//check if bp is valid (same header/footer and allocation status)
-				//is size bits in the header and footer the same?
-				if (GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp))) {
-					printf("block %p in size group %d has different header and footer size\n", bp, i);
-					is_all_valid = 0; //unset the flag
-				}
-				//is allocation status of the header and footer set to 0?
-				if (GET_ALLOC(HDRP(bp)) == 0 && GET_ALLOC(FTRP(bp)) == 0) {
-					printf("block %p in size group %d has different header and footer allocation status\n", bp, i);
-					is_all_valid = 0; //unset the flag
-				}
-
-				if (GET_SIZE(HDRP(bp)) % DSIZE != 0) {
-					printf("block %p in size group %d is not doubly aligned (8 B)\n", bp, i);
-				}
-			}
-		}
-	}
+    size_t words, listed = 0, found = 0;
+
+    //the bitmap is sized before taking the lock (in the LD_PRELOAD build malloc is ours)
+    for (;;) {
+        words = (mem_heapsize() / DSIZE + 63) / 64;
+        if (words > check_words) {
+            free(check_map);
+            if ((check_map = malloc(words * sizeof(uint64_t))) == NULL) {
+                check_words = 0;
+                printf("mm_check: no memory for the free-list bitmap\n");
+                return 0;
+            }
+            check_words = words;
+        }
+        LOCK();
+        if ((mem_heapsize() / DSIZE + 63) / 64 <= check_words)
+            break;
+        UNLOCK(); //the heap grew meanwhile
+    }
+    memset(check_map, 0, words * sizeof(uint64_t));
+    check_errors = 0;
+
+    listed = check_lists();
+    found = check_blocks();
+    if (listed != found)
+        check_error(NULL, "the free lists hold %lu blocks, the heap %lu", (unsigned long) listed, (unsigned long) found);
+    UNLOCK();
+    return check_errors == 0;
+}
 
-	//Are there any contiguous free blocks that somehow escaped coalescing?
-    	//Are the allocated blocks in the heap valid?
-	
-	printf("Heap Checking Process..\n");
-	for (bp = heap_listp + DSIZE; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-        	if (GET_ALLOC(HDRP(bp)) == 0) { //if the current block is a free block
-			if (GET_ALLOC(HDRP(PREV_BLKP(bp))) == 0 || GET_ALLOC(HDRP(NEXT_BLKP(bp))) == 0) {
-				printf("There is a contiguous block near %p which escaped coalescing\n", bp);
-			}
-		}
-		else { //check the validity of the allocated blocks in the heap
-			if (GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp))) {
-				printf("block %p has different header and footer size\n", bp);
-			}
-			if (GET_ALLOC(HDRP(bp)) == 0 && GET_ALLOC(FTRP(bp)) == 0) {
-                                printf("block %p has different header and footer allocation status\n", bp);
-                        }
-                        if (GET_SIZE(HDRP(bp)) % DSIZE != 0) {
-                                printf("block %p is not doubly aligned (8 B)\n", bp);
-                        }
-		}
-    	} 
-	
-	if (is_marked_as_free && is_all_valid) {
-                printf("Blocks are all marked as free and valid\n");
+/* Description of static void check_error(void *bp, const char *fmt, ...)
+ * reports a problem mm_check found at block bp (if not NULL). only the first
+ * CHECK_REPORTS problems are printed.
+ */
+static void check_error(void *bp, const char *fmt, ...) {
+    va_list ap;
+
+    if (check_errors++ >= CHECK_REPORTS)
+        return;
+    printf("mm_check: ");
+    if (bp != NULL)
+        printf("block %p: ", bp);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+/* Description of static int check_bounds(char *bp)
+ * is bp a plausible block pointer : ALIGNMENT-aligned, with a header and minimum block inside the heap?
+ */
+static int check_bounds(char *bp) {
+    return bp > heap_listp && (char *) bp + MIN_BLOCK - WSIZE <= (char *) mem_heap_hi() + 1 &&
+           ((unsigned long) (bp - heap_base) & (ALIGNMENT - 1)) == 0;
+}
+
+/* Description of static size_t check_lists(void)
+ * walks every free list : each block must be a free block of its size group, linked back
+ * to its predecessor, and in no other list (its bit in check_map is set here).
+ * also checks the group bitmaps against the lists. returns the number of listed blocks.
+ */
+static size_t check_lists(void) {
+    size_t listed = 0, limit = mem_heapsize() / MIN_BLOCK;
+    size_t off, size;
+    char *bp, *prev;
+
+    for (int i = 0; i < SEGLIST_SIZE; i++) {
+        bp = GET_LINK(SEG_HEAD(i));
+        if (!(sl_bitmap[i / SL_COUNT] & (1U << (i % SL_COUNT))) != (bp == NULL))
+            check_error(NULL, "size group %d : its bitmap bit disagrees with its list", i);
+        for (prev = SEG_HEAD(i); bp != NULL; prev = bp, bp = FREE_NEXT_BLKP(bp)) {
+            if (!check_bounds(bp)) {
+                check_error(bp, "in size group %d, out of the heap or misaligned", i);
+                break;
+            }
+            off = (bp - heap_base) / DSIZE;
+            if (check_map[off / 64] & CHECK_BIT(off)) {
+                check_error(bp, "in size group %d, listed twice (or the list loops)", i);
+                break;
+            }
+            check_map[off / 64] |= CHECK_BIT(off);
+            if (++listed > limit) //cannot happen without a loop
+                break;
+            size = GET_SIZE(HDRP(bp));
+            if (GET_ALLOC(HDRP(bp)))
+                check_error(bp, "in size group %d, but allocated", i);
+            else if (size < MIN_BLOCK || bp + size > (char *) mem_heap_hi() + 1)
+                check_error(bp, "in size group %d, has a bad size %lu", i, (unsigned long) size);
+            else if (seg_index(size) != i)
+                check_error(bp, "of %lu bytes, in size group %d instead of %d", (unsigned long) size, i, seg_index(size));
+            if (FREE_PREV_BLKP(bp) != prev)
+                check_error(bp, "in size group %d, its prev link does not point back", i);
+        }
+    }
+    for (int fl = 0; fl < FL_COUNT; fl++)
+        if (!(fl_bitmap & (1U << fl)) != !sl_bitmap[fl])
+            check_error(NULL, "class %d : its first-level bit disagrees with its groups", fl);
+    return listed;
+}
+
+/* Description of static size_t check_blocks(void)
+ * sweeps the heap from the prologue to the epilogue : block sizes and bounds, the
+ * prev-allocated bits, free-block footers, coalescing, and that every free block is
+ * marked in check_map. returns the number of free blocks.
+ */
+static size_t check_blocks(void) {
+    size_t found = 0, size, off;
+    char *end = (char *) mem_heap_hi() + 1;
+    char *bp;
+    int prev_alloc = 1; //the prologue
+
+    if (GET(HDRP(heap_listp)) != PACK(DSIZE, 1) || GET(FTRP(heap_listp)) != PACK(DSIZE, 1))
+        check_error(heap_listp, "the prologue is damaged");
+    for (bp = NEXT_BLKP(heap_listp); (size = GET_SIZE(HDRP(bp))) > 0; bp = NEXT_BLKP(bp)) {
+        if (size % ALIGNMENT || size < MIN_BLOCK || bp + size > end) {
+            check_error(bp, "bad size %lu (heap ends at %p)", (unsigned long) size, end);
+            return found; //the rest of the heap cannot be walked
+        }
+        if (!GET_PREV_ALLOC(HDRP(bp)) != !prev_alloc)
+            check_error(bp, "its prev-allocated bit is %s", prev_alloc ? "clear" : "set");
+        if (!GET_ALLOC(HDRP(bp))) {
+            found++;
+            if (GET(FTRP(bp)) != PACK(size, 0))
+                check_error(bp, "header and footer of the free block differ");
+            if (!prev_alloc)
+                check_error(bp, "escaped coalescing with the block before it");
+            off = (bp - heap_base) / DSIZE;
+            if (!(check_map[off / 64] & CHECK_BIT(off)))
+                check_error(bp, "free, but in no free list");
         }
-	return 0;
+#if !ELIDE_FOOTERS
+        else if (GET(FTRP(bp)) != PACK(size, 1))
+            check_error(bp, "header and footer of the allocated block differ");
+#endif
+        prev_alloc = GET_ALLOC(HDRP(bp));
+    }
+    if (bp != end)
+        check_error(bp, "the epilogue is not at the end of the heap (%p)", end);
+    else if (!GET_ALLOC(HDRP(bp)) || !GET_PREV_ALLOC(HDRP(bp)) != !prev_alloc)
+        check_error(bp, "the epilogue header is damaged");
+    return found;
 }
 
 int mm_init(void)
 {
-    int seglist_size = 16; //the maximum index of the seglist.
+    int seglist_size = SEGLIST_SIZE; //the maximum index of the seglist.
+
+    heap_clean = mem_heap_dirty(); //what lies above the old brk is untouched
     //try extending the heap for availing the space for the seglist, the prologue header/ footer, and the epilogue block.
     if ((heap_listp = mem_sbrk(WSIZE*(seglist_size + 4))) == (void *) -1)
         return -1;
@@ -151,14 +520,36 @@ int mm_init(void)
 	*(heap_listp+i) = 0; //set all seglist words (storing address) to 0
     }
  
-    seg_listp = (char **) (heap_listp);
+    heap_base = mem_heap_lo();
+    heap_grain = mem_hugepagesize();
+    seg_listp = heap_listp;
+    fl_bitmap = 0; //every size group starts out empty
+    memset(sl_bitmap, 0, sizeof(sl_bitmap));
+#ifndef MM_THREADS
+    memset(slab_partial, 0, sizeof(slab_partial)); //no slab runs yet
+#endif
+    memset(slab_map, 0, (slab_map_top + 31) / 32 * sizeof(unsigned int));
+    slab_map_top = 0;
+    memset(reserve_table, 0, sizeof(reserve_table)); //no growing blocks
+    memset(fastbins, 0, sizeof(fastbins));
+    fastbin_used = 0;
+    reserve_next = 0;
+    extend_gen = 0;
+#ifdef MM_STATS
+    memset(&stats, 0, sizeof(stats));
+#endif
+#ifdef MM_THREADS
+    heap_gen++; //every thread cache (and the blocks it held) belonged to the old heap
+    orphan_caches = NULL;
+#endif
 
     heap_listp += seglist_size * WSIZE; //move pointer of the heap
     PUT(heap_listp, 0); //padding for the alignment.
     PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); // prologue header
     PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); // prologue footer
-    PUT(heap_listp + (3*WSIZE), PACK(0, 1)); // epilogue header
+    PUT(heap_listp + (3*WSIZE), PACK(0, 1) | PREV_ALLOC); // epilogue header (the prologue before it is allocated)
     heap_listp += (2*WSIZE); // make heap pointer point to the location between prologue footer and the epilogue header.
+    //(the seglist is a multiple of 16 bytes, so the first block starts ALIGNMENT-aligned)
 
     // extend heap with a free block of size 4096 bytes (1024 words)
     if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
@@ -167,186 +558,866 @@ int mm_init(void)
     return 0;
 }
 
+/* Description of void mm_atfork_prepare(void), mm_atfork_parent(void), mm_atfork_child(void)
+ * pthread_atfork handlers : the heap lock is held across fork, so no other thread is in the
+ * middle of changing the heap the child gets a copy of. the child starts the lock afresh.
+ */
+void mm_atfork_prepare(void)
+{
+    LOCK();
+}
+
+void mm_atfork_parent(void)
+{
+    UNLOCK();
+}
+
+void mm_atfork_child(void)
+{
+#ifdef MM_THREADS
+    pthread_mutex_init(&mm_lock, NULL);
+#endif
+}
+
 void *mm_malloc(size_t size)
 {
-    size_t asize; // adjusted block size
-    size_t extendsize; // the amount to extend the heap by if there's no fit
+    void *bp;
+    STAT_INC(malloc_calls);
+#ifdef MM_THREADS
+    thread_cache_t *tc = tcache_get();
+
+    if (tc == NULL)
+        return NULL;
+    if (size > 0 && size <= SLAB_MAX) {
+        if (__atomic_load_n(&tc->remote_frees, __ATOMIC_RELAXED))
+            slab_drain(tc); //take back what other threads freed first
+        if (tc->slab_partial[ALIGN(size) / ALIGNMENT] != NULL)
+            return slab_alloc(size); //a run of ours has a free slot, no lock needed
+    }
+    else if (size > SLAB_MAX && size <= TCACHE_MAX && (bp = tc->bins[TC_INDEX(ADJUST_SIZE(size))]) != NULL) {
+        tc->bins[TC_INDEX(ADJUST_SIZE(size))] = *(void **) bp; //lock-free hit in the thread cache
+        tc->counts[TC_INDEX(ADJUST_SIZE(size))]--;
+        return bp;
+    }
+#endif
+    LOCK();
+    bp = do_malloc(size);
+    UNLOCK();
+    return bp;
+}
+
+void mm_free(void *bp)
+{
+    if (bp == NULL)
+        return;
+    STAT_INC(free_calls);
+#ifdef MM_THREADS
+    tcache_get();
+#endif
+    if (IS_SLAB(bp)) {
+        slab_put(bp, 0); //takes the lock only to give an empty run back
+        return;
+    }
+#ifdef MM_THREADS
+    if (my_cache != NULL && tcache_put(my_cache, bp, HDR_SIZE(bp)))
+        return;
+#endif
+    LOCK();
+    do_free(bp);
+    UNLOCK();
+}
+
+/* Description of void mm_free_sized(void *bp, size_t size)
+ * mm_free for a block the caller last allocated (or reallocated) with size bytes.
+ * small blocks go to their bin by that size, without decoding the header.
+ * built with MM_DEBUG, it checks the size against the header first.
+ */
+void mm_free_sized(void *bp, size_t size)
+{
+    if (bp == NULL)
+        return;
+#ifdef MM_DEBUG
+    //the size must be the one the block was asked for (checked from the header alone)
+    assert(IS_SLAB(bp) ? size <= RUN_OF(bp)->objsize :
+           size <= HDR_SIZE(bp) - (IS_MMAPPED(bp) ? MAP_HDR : ALLOC_OVERHEAD));
+#endif
+#ifdef MM_THREADS
+    tcache_get();
+#endif
+    if (size <= SLAB_MAX && IS_SLAB(bp)) { //(larger sizes are never slab objects)
+        STAT_INC(free_calls);
+        slab_put(bp, 0);
+        return;
+    }
+    if (size <= SLAB_MAX || ADJUST_SIZE(size) > FASTBIN_MAX) { //small heap blocks (memalign, realloc) or large ones
+        mm_free(bp);
+        return;
+    }
+    STAT_INC(free_calls);
+#ifdef MM_THREADS
+    if (my_cache != NULL && tcache_put(my_cache, bp, ADJUST_SIZE(size)))
+        return;
+#endif
+    LOCK();
+    fastbin_put(bp, ADJUST_SIZE(size)); //a block this small is neither mapped nor growing
+    UNLOCK();
+}
+
+/* Description of size_t mm_malloc_batch(size_t size, size_t n, void **out)
+ * allocates n blocks of size bytes into out[0..n-1]. heap blocks are carved back to back
+ * from a single free block in one pass. returns the number of blocks allocated
+ * (less than n only when memory runs out).
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t done = 0;
+
+    if (size == 0 || n == 0)
+        return 0;
+#ifdef MM_THREADS
+    if (tcache_get() == NULL)
+        return 0;
+#endif
+    LOCK();
+    if (size > SLAB_MAX && size < MMAP_THRESHOLD && n <= MAP_MAX / ADJUST_SIZE(size))
+        done = carve_blocks(ADJUST_SIZE(size), n, out);
+    for (; done < n && (out[done] = do_malloc(size)) != NULL; done++) //slab objects, mappings, or no single fit
+        ;
+    UNLOCK();
+    STAT_ADD(malloc_calls, done);
+    return done;
+}
+
+/* Description of void mm_free_batch(void **ptrs, size_t n)
+ * frees the n blocks of ptrs (NULL entries are skipped). ptrs is sorted by address in
+ * place, so neighbouring heap blocks are merged in one sweep and coalesced with the
+ * rest of the heap once per run.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t i, size;
     char *bp;
-	
-    asize = ALIGN(size + SIZE_T_SIZE); //align block
+
+#ifdef MM_THREADS
+    tcache_get();
+#endif
+    qsort(ptrs, n, sizeof(void *), ptr_cmp);
+    LOCK();
+    for (i = 0; i < n; ) {
+        if ((bp = ptrs[i++]) == NULL)
+            continue;
+        STAT_INC(free_calls);
+        if (IS_SLAB(bp) || IS_MMAPPED(bp)) {
+            do_free(bp);
+            continue;
+        }
+        reserve_drop(bp);
+        size = GET_SIZE(HDRP(bp));
+        while (i < n && (char *) ptrs[i] == bp + size) { //the next heap block is freed too : one run
+            STAT_INC(free_calls);
+            reserve_drop(ptrs[i]);
+            size += GET_SIZE(HDRP(ptrs[i++]));
+        }
+        PUT_HDR(bp, size, 1);
+        PUT_ALLOC_FTR(bp, size);
+        free_block(bp); //coalesces the whole run with its neighbours at once
+    }
+    UNLOCK();
+}
+
+/* Description of size_t mm_usable_size(void *bp)
+ * the number of bytes the caller may use in the block bp, which can exceed the size
+ * it asked for. the caller owns all of them : a block that mm_realloc reserved
+ * headroom for stops being tracked, so the headroom is never taken back.
+ */
+size_t mm_usable_size(void *bp)
+{
+    size_t size;
+
+    if (bp == NULL)
+        return 0;
+    if (IS_SLAB(bp))
+        return RUN_OF(bp)->objsize;
+    size = HDR_SIZE(bp);
+    if (IS_MMAPPED(bp))
+        return size - MAP_HDR;
+    if (size >= RESERVE_MIN) {
+        LOCK();
+        reserve_drop(bp);
+        UNLOCK();
+    }
+    return size - ALLOC_OVERHEAD;
+}
+
+void *mm_realloc(void *ptr, size_t size)
+{
+    void *newptr;
+
+    STAT_INC(realloc_calls);
+#ifdef MM_THREADS
+    tcache_get();
+#endif
+    LOCK();
+    newptr = do_realloc(ptr, size);
+    UNLOCK();
+    return newptr;
+}
+
+/* Description of void *mm_memalign(size_t alignment, size_t size)
+ * allocates size bytes at a multiple of alignment (a power of two).
+ * the slack in front of the block is split off as a free block, not wasted.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    void *bp;
+
+    if (alignment & (alignment - 1)) { //not a power of two
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT)
+        return mm_malloc(size); //every block is aligned that much
+    STAT_INC(memalign_calls);
+#ifdef MM_THREADS
+    if (tcache_get() == NULL)
+        return NULL;
+#endif
+    LOCK();
+    bp = do_memalign(alignment, size);
+    UNLOCK();
+    return bp;
+}
+
+/* Description of int mm_posix_memalign(void **memptr, size_t alignment, size_t size)
+ * posix_memalign : alignment must be a power of two multiple of sizeof(void *).
+ * returns 0 (with the block in *memptr), EINVAL or ENOMEM.
+ */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *bp;
+
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)))
+        return EINVAL;
+    if ((bp = mm_memalign(alignment, size)) == NULL && size > 0)
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+/* Description of void *mm_aligned_alloc(size_t alignment, size_t size)
+ * C11 aligned_alloc : alignment must be a power of two.
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size)
+{
+    return mm_memalign(alignment, size);
+}
+
+/* Description of void *mm_calloc(size_t nmemb, size_t size)
+ * allocates a zeroed array of nmemb elements of size bytes.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    void *bp;
+
+    STAT_INC(calloc_calls);
+    if (size != 0 && nmemb > (size_t) -1 / size) { //nmemb * size overflows
+        errno = ENOMEM;
+        return NULL;
+    }
+#ifdef MM_THREADS
+    if (tcache_get() == NULL)
+        return NULL;
+#endif
+    LOCK();
+    bp = do_calloc(nmemb * size);
+    UNLOCK();
+    return bp;
+}
+
+/* Description of int mm_stats(mm_stats_t *st)
+ * copies the counters kept since mm_init to st, and counts the blocks now in the free
+ * lists of each size class. returns -1 (leaving st alone) unless built with MM_STATS.
+ */
+int mm_stats(mm_stats_t *st)
+{
+#ifdef MM_STATS
+    char *bp;
+
+    LOCK();
+    *st = stats;
+    memset(st->free_blocks, 0, sizeof(st->free_blocks));
+    for (int i = 0; i < SEGLIST_SIZE; i++)
+        for (bp = GET_LINK(SEG_HEAD(i)); bp != NULL; bp = FREE_NEXT_BLKP(bp))
+            st->free_blocks[MIN(i / SL_COUNT, MM_STATS_CLASSES - 1)]++;
+    UNLOCK();
+    return 0;
+#else
+    (void) st;
+    return -1;
+#endif
+}
+
+/* Description of static void *do_malloc(size_t size)
+ * mm_malloc without the thread cache; the caller holds the lock.
+ */
+static void *do_malloc(size_t size)
+{
     // ignore non-positive values
     if (size <= 0)
         return NULL;
+
+    if (size <= SLAB_MAX) {
+#ifdef MM_THREADS
+        if (my_cache == NULL) //no thread cache to own the runs
+            return NULL;
+#endif
+        return slab_alloc(size); //small objects come from the slab runs
+    }
+    if (size >= MMAP_THRESHOLD)
+        return map_block(size); //large objects get a mapping of their own
 	
-    // adjust block size to include overhead and satisfy 8-byte alignment
+    // adjust block size to include overhead and satisfy ALIGNMENT
+    return malloc_block(ADJUST_SIZE(size));
+}
 
-    // search the free list for a fit
-    if ((bp = find_fit(asize)) != NULL) {
-        place(bp, asize);
+/* Description of static void *do_memalign(size_t alignment, size_t size)
+ * mm_memalign for alignments above ALIGNMENT; the caller holds the lock.
+ * large blocks get a mapping when it is aligned enough (up to MAP_HDR), others come from the heap.
+ */
+static void *do_memalign(size_t alignment, size_t size)
+{
+    //alloc_aligned_block searches for ADJUST_SIZE(size) + alignment + MIN_BLOCK bytes,
+    //and ADJUST_SIZE adds at most ALLOC_OVERHEAD + ALIGNMENT - 1 : all of it must fit 32 bits
+    size_t room = MAP_MAX - MIN_BLOCK - ALLOC_OVERHEAD - ALIGNMENT;
+    void *bp;
+
+    if (size == 0)
+        return NULL;
+    if (size >= MMAP_THRESHOLD && alignment <= MAP_HDR && (bp = map_block(size)) != NULL)
         return bp;
+    if (alignment > room || size > room - alignment || //cannot be in a 4 GB heap
+        (bp = alloc_aligned_block(ADJUST_SIZE(size), alignment)) == NULL) {
+        errno = ENOMEM;
+        return NULL;
     }
+    return bp;
+}
 
-    // no fit found. extend the heap and place
-    extendsize = MAX(asize, CHUNKSIZE);
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+/* Description of static void *do_calloc(size_t size)
+ * mm_calloc; the caller holds the lock. skips the memset for memory that is zero already.
+ */
+static void *do_calloc(size_t size)
+{
+    char *fresh = heap_clean; //(the allocation moves it)
+    char *bp;
+
+    if (size >= MMAP_THRESHOLD)
+        return map_block(size); //a new mapping reads as zero
+    if ((bp = do_malloc(size)) == NULL)
         return NULL;
-    place(bp, asize);
-    //mm_check();
+    if (IS_SLAB(bp) || bp < fresh) { //recycled memory
+        memset(bp, 0, size);
+        return bp;
+    }
+    PUT(FREE_PREV(bp), 0); //clear the tags of the free block it was carved from
+    PUT(FREE_NEXT(bp), 0);
+#if ELIDE_FOOTERS
+    PUT(FTRP(bp), 0); //(its free-block footer, if it was not split; the payload covers it)
+#endif
     return bp;
 }
 
-void mm_free(void *bp)
+/* Description of static size_t carve_blocks(size_t asize, size_t n, void **out)
+ * mm_malloc_batch for heap blocks : takes one free block of n * asize bytes and splits it
+ * into n allocated blocks, the rest going back as one free block. returns n, or 0 if no
+ * free block is large enough (the heap is not extended for the batch : the blocks are
+ * then allocated one by one, filling the smaller holes first).
+ */
+static size_t carve_blocks(size_t asize, size_t n, void **out)
 {
-    size_t size = GET_SIZE(HDRP(bp));
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
-    PUT(FREE_PREV(bp), 0);
-    PUT(FREE_NEXT(bp), 0);
-    seg_insert_freeblock(coalesce(bp));//After coalescing, insert freed block in the seglist
+    size_t total = asize * n;
+    size_t csize, last, bsize, rest, i;
+    char *bp;
+
+    if ((bp = find_fit(total)) == NULL &&
+        (!fastbin_consolidate() || (bp = find_fit(total)) == NULL))
+        return 0;
+
+    seg_remove_freeblock(bp);
+    csize = GET_SIZE(HDRP(bp));
+    last = (csize - total < MIN_BLOCK) ? asize + (csize - total) : asize; //the last block takes a remainder too small to stand alone
+    for (i = 0; i < n; i++) {
+        bsize = (i == n - 1) ? last : asize;
+        if (i == 0)
+            PUT_HDR(bp, bsize, 1); //(keeps the prev-allocated bit of the free block)
+        else
+            PUT(HDRP(bp), PACK(bsize, 1) | PREV_ALLOC);
+        PUT_ALLOC_FTR(bp, bsize);
+        out[i] = bp;
+        bp = NEXT_BLKP(bp);
+    }
+    MARK_USED(bp);
+    if ((rest = csize - (total - asize + last)) > 0) { //the remainder goes back as one free block
+        PUT(HDRP(bp), PACK(rest, 0) | PREV_ALLOC);
+        PUT(FTRP(bp), PACK(rest, 0));
+        seg_insert_freeblock(bp);
+    } else
+        SET_PREV_ALLOC(bp);
+    return n;
 }
 
-void *mm_realloc(void *ptr, size_t size)
+/* Description of static int ptr_cmp(const void *a, const void *b)
+ * qsort order of block pointers : by address.
+ */
+static int ptr_cmp(const void *a, const void *b)
+{
+    unsigned long x = (unsigned long) *(void * const *) a;
+    unsigned long y = (unsigned long) *(void * const *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Description of static void do_free(void *bp)
+ * mm_free without the thread cache; the caller holds the lock.
+ */
+static void do_free(void *bp)
+{
+    if (IS_SLAB(bp)) {
+        slab_put(bp, 1);
+        return;
+    }
+    if (IS_MMAPPED(bp)) {
+        mem_unmap(MAP_BASE(bp));
+        return;
+    }
+    if (GET_SIZE(HDRP(bp)) <= FASTBIN_MAX) { //defer the coalescing : it is likely wanted again as is
+        fastbin_put(bp, GET_SIZE(HDRP(bp)));
+        return;
+    }
+    reserve_drop(bp); //a growing block stops being one
+    free_block(bp);
+}
+
+/* Description of static void *do_realloc(void *ptr, size_t size)
+ * mm_realloc; the caller holds the lock.
+ */
+static void *do_realloc(void *ptr, size_t size)
 {
     void *oldptr = ptr;
     void *newptr;
     size_t copySize, alignedSize;
+    reserve_t *res;
       	
     if (ptr == NULL) {
-	return mm_malloc(size);
+	return do_malloc(size);
     } //if ptr == NULL, realloc works same as mm_malloc.
     
     if (size == 0) {
-	mm_free(ptr);
+	do_free(ptr);
 	newptr = NULL;
 	return newptr; // if size == 0, realloc works same as mm_free.
     }
+
+    if (size > MAP_MAX - MAP_HDR) //no block can be that large (and ADJUST_SIZE would wrap); the old one stays
+	return NULL;
+
+    if (IS_SLAB(ptr)) { //slab objects cannot grow in place; keep them while the object size suffices
+	copySize = RUN_OF(ptr)->objsize;
+	if (size <= copySize) {
+	    STAT_INC(realloc_inplace);
+	    return ptr;
+	}
+	if ((newptr = do_malloc(size)) == NULL)
+	    return NULL;
+	STAT_INC(realloc_copy);
+	memcpy(newptr, ptr, copySize);
+	slab_put(ptr, 1);
+	return newptr;
+    }
+
+    if (IS_MMAPPED(ptr)) { //mapped blocks are resized by the system, or move back to the heap when they get small
+	if (size >= MMAP_THRESHOLD) {
+	    if ((newptr = remap_block(ptr, size)) != NULL)
+		STAT_INC(realloc_inplace); //(mremap moves the pages, not the data)
+	    return newptr;
+	}
+	copySize = GET_SIZE(HDRP(ptr)) - MAP_HDR;
+	if ((newptr = do_malloc(size)) == NULL)
+	    return NULL;
+	STAT_INC(realloc_copy);
+	memcpy(newptr, ptr, MIN(size, copySize));
+	mem_unmap(MAP_BASE(ptr));
+	return newptr;
+    }
     	
     //if the size is nonzero
     else {
 	copySize = GET_SIZE(HDRP(oldptr));
 	
-	alignedSize = ALIGN(size + SIZE_T_SIZE);
- 
+	alignedSize = ADJUST_SIZE(size);
+	res = copySize >= RESERVE_MIN ? reserve_find(oldptr) : NULL;
 
+	if (res && alignedSize >= res->size && alignedSize <= copySize) { //a growing block : the headroom covers it
+	  STAT_INC(realloc_inplace);
+	  res->size = alignedSize;
+	  res->gen = extend_gen;
+	  return ptr;
+	}
+	if (res && alignedSize < res->size) { //the block stopped growing; the shrink below gives the headroom back
+	  res->bp = NULL;
+	  res = NULL;
+	}
 
 	//printf("copysize : %d | alignedSize : %d | size : %d\n", copySize, alignedSize, size);
+	if (alignedSize <= copySize)
+	  STAT_INC(realloc_inplace);
 	if (alignedSize == copySize)
 	  return ptr;
 	
 	else if (alignedSize < copySize) { //the block is shrunk while re-allocating the block.
           //first align the size we're allocating (copying) 
-	  if (copySize - alignedSize >= 2*DSIZE) { //minimum block size = 16 B
-		PUT(HDRP(oldptr), PACK(alignedSize, 1));
-		PUT(FTRP(oldptr), PACK(alignedSize, 1)); //replace current block pointer to an alloc block of size, alignedSize.	
-		//now next block is the remaining part of the old block (oldptr, ptr)
-		PUT(HDRP(NEXT_BLKP(oldptr)), PACK(copySize - alignedSize, 0));
-		PUT(FTRP(NEXT_BLKP(oldptr)), PACK(copySize - alignedSize, 0)); //assign remaining part of the oldptr to free block.
-		seg_insert_freeblock(NEXT_BLKP(oldptr)); //insert newly made free block
-	  	
-		 //return the allocated block
-	  }
+	  if (copySize - alignedSize >= MIN_BLOCK) //minimum block size = 16 B
+		realloc_split(oldptr, copySize, alignedSize); //the remaining part of the old block becomes a free block
 	  return oldptr;
 	  //copySize = size;
 	}
-	else { //check if the block can be expanded while re-allocating the block.
-	
-		//int prev_exists = (PREV_BLKP(oldptr) != (void*) 0);
-		int next_exists = (NEXT_BLKP(oldptr) != (void*) 0);
-		//print_block(PREV_BLKP(oldptr));
-		//print_block(NEXT_BLKP(oldptr));
-		//int coal_with_prev_block_size = 0;
-	        int coal_with_next_block_size = 0;
-	        //int coal_with_both_block_size = 0;
-		/*if (prev_exists)
-			coal_with_prev_block_size = GET_SIZE(PREV_BLKP(oldptr)) + copySize;
-		*/
-		if (next_exists)
-			coal_with_next_block_size = GET_SIZE(HDRP(NEXT_BLKP(oldptr))) + copySize;
-			
-		/*if (prev_exists && next_exists)
-			coal_with_both_block_size = coal_with_prev_block_size + coal_with_next_block_size - copySize;
-		*/
-		//check if previous block could be coalesced with the current block
-		/*if (prev_exists && (coal_with_prev_block_size >= alignedSize) && (GET_ALLOC(PREV_BLKP(oldptr)) == 0)) {
-			//if previous block size + oldptr block size is enough for the requested size and that block is unalloc
-			PUT(HDRP(oldptr), PACK(copySize, 0)); //unallocate the block
-			PUT(FTRP(oldptr), PACK(copySize, 0));
-			seg_remove_freeblock(PREV_BLKP(oldptr)); //remove previous block (which is free) from the seglist.
-			PUT(HDRP(PREV_BLKP(oldptr)), PACK(alignedSize, 1)); //allocate on previous block
-			PUT(FTRP(PREV_BLKP(oldptr)), PACK(alignedSize, 1));
-			PUT(HDRP(NEXT_BLKP(PREV_BLKP(oldptr))), PACK(coal_with_prev_block_size - alignedSize, 0)); //mark remaining block as unalloc
-                        PUT(FTRP(NEXT_BLKP(PREV_BLKP(oldptr))), PACK(coal_with_prev_block_size - alignedSize, 0));
-
-			if (coal_with_prev_block_size - alignedSize >= 2*DSIZE) { //minimum block = 16 B
-				seg_insert_freeblock(NEXT_BLKP(PREV_BLKP(oldptr))); //insert the remaining unalloc block.in the seglist.
-			}
-			return PREV_BLKP(oldptr);
-		}*/
-		if (next_exists && (coal_with_next_block_size >= alignedSize) && (GET_ALLOC(HDRP(NEXT_BLKP(oldptr))) == 0)) {
-			//PUT(HDRP(oldptr), PACK(copySize, 0));
-			//PUT(FTRP(oldptr), PACK(copySize, 0));
-			seg_remove_freeblock(NEXT_BLKP(oldptr));
-			PUT(HDRP(oldptr), PACK(coal_with_next_block_size, 1));
-			PUT(FTRP(oldptr), PACK(coal_with_next_block_size, 1));
-			//PUT(HDRP(NEXT_BLKP(ptr)), PACK(coal_with_next_block_size - alignedSize, 0));
-			//PUT(FTRP(NEXT_BLKP(ptr)), PACK(coal_with_next_block_size - alignedSize, 0));
-
-			//print_block(ptr);
-                	//print_block(NEXT_BLKP(ptr));
-
-			/*if (coal_with_next_block_size - alignedSize >= 2*DSIZE) {
-				seg_insert_freeblock(NEXT_BLKP(ptr));
-			}*/
-			return oldptr;
+	else { //grow the block in place where its neighbours allow it; otherwise move it.
+		char *next = NEXT_BLKP(oldptr);
+		size_t next_size = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next)); //bytes of a free next block
+		size_t prev_size = GET_PREV_ALLOC(HDRP(oldptr)) ? 0 : GET_SIZE(HDRP(PREV_BLKP(oldptr))); //bytes of a free previous block
+		size_t want = alignedSize; //block size to take : a block that grew before gets headroom (as far as it fits)
+
+		if (res)
+			want += HEADROOM(alignedSize);
+
+		//case 1 : the next block is free and large enough
+		if (copySize + next_size >= alignedSize) {
+			seg_remove_freeblock(next);
+			realloc_split(oldptr, copySize + next_size, MIN(want, copySize + next_size));
+			STAT_INC(realloc_inplace);
+			return reserve_note(res, oldptr, alignedSize);
 		}
-
-		/*else if (prev_exists && next_exists && (coal_with_both_block_size >= alignedSize) && (GET_ALLOC(PREV_BLKP(oldptr))) == 0 && (GET_ALLOC(NEXT_BLKP(oldptr))) == 0 ) {
-			PUT(HDRP(oldptr), PACK(copySize, 0));
-			PUT(FTRP(oldptr), PACK(copySize, 0));
-			seg_remove_freeblock(PREV_BLKP(oldptr));
-			seg_remove_freeblock(NEXT_BLKP(oldptr));
-			PUT(HDRP(PREV_BLKP(oldptr)), PACK(alignedSize, 1));
-			PUT(FTRP(PREV_BLKP(oldptr)), PACK(alignedSize, 1));
-			PUT(HDRP(NEXT_BLKP(PREV_BLKP(oldptr))), PACK(coal_with_both_block_size - alignedSize, 0));
-			PUT(FTRP(NEXT_BLKP(PREV_BLKP(oldptr))), PACK(coal_with_both_block_size - alignedSize, 0));
-
-			if (coal_with_both_block_size - alignedSize >= 2*DSIZE) {
-				seg_insert_freeblock(NEXT_BLKP(PREV_BLKP(oldptr)));
-			}
-			return PREV_BLKP(oldptr);
-		}*/
-		
+		//case 2 : the previous block (with the next one, if free) is large enough; slide the payload down
+		if (prev_size && prev_size + copySize + next_size >= alignedSize) {
+			newptr = PREV_BLKP(oldptr);
+			seg_remove_freeblock(newptr); //before the payload overwrites its links
+			if (next_size)
+				seg_remove_freeblock(next);
+			memmove(newptr, oldptr, copySize - ALLOC_OVERHEAD);
+			realloc_split(newptr, prev_size + copySize + next_size, MIN(want, prev_size + copySize + next_size));
+			STAT_INC(realloc_inplace); //(slid within the coalesced space)
+			return reserve_note(res, newptr, alignedSize);
+		}
+		//case 3 : the block (or the free block after it) ends the heap; extend the heap by the difference
+		//(at least a minimum block, as the new space is a free block until we take it). growing at
+		//the top never copies, so it takes no headroom : that would only raise the heap's peak
+		if (GET_SIZE(HDRP(next_size ? NEXT_BLKP(next) : next)) == 0 &&
+		    extend_heap(MAX(alignedSize - copySize - next_size, MIN_BLOCK) / WSIZE) != NULL) {
+			next_size = GET_SIZE(HDRP(next)); //the new space was coalesced into a free block at next
+			seg_remove_freeblock(next);
+			realloc_split(oldptr, copySize + next_size, alignedSize);
+			STAT_INC(realloc_inplace);
+			return reserve_note(res, oldptr, alignedSize);
+		}
+		if (size >= MMAP_THRESHOLD)
+			want = alignedSize; //it moves to a mapping, which mem_remap grows
+		else if (size + (want - alignedSize) >= MMAP_THRESHOLD)
+			want = alignedSize + ((MMAP_THRESHOLD - 1 - size) & ~(ALIGNMENT - 1)); //headroom up to the mapping threshold
+		newptr = do_malloc(size + (want - alignedSize));
+		if (newptr == NULL && want > alignedSize)
+			newptr = do_malloc(size); //no room for the headroom
+		if (newptr == NULL)
+			return NULL;
+		STAT_INC(realloc_copy);
+		if (res)
+			copySize = res->size; //the malloc may have released the headroom of the old block
+		memcpy(newptr, oldptr, copySize - ALLOC_OVERHEAD); //copy the payload only
+		do_free(oldptr);
+		return reserve_note(res, newptr, alignedSize);
 	}
-	newptr = mm_malloc(size);
-        if (newptr == NULL)
-          return NULL;
-	memcpy(newptr, oldptr, copySize);
-    	mm_free(oldptr);
-    	return newptr;
     }
 }
 
 
 
+/* Description of static void realloc_split(void *bp, size_t csize, size_t asize)
+ * makes the reallocated block bp span csize bytes (any free blocks it took over are
+ * already out of the seglist) and splits off whatever lies beyond asize as a free block,
+ * merged with the block after it if that one is free too.
+ */
+static void realloc_split(void *bp, size_t csize, size_t asize) {
+    if (csize - asize >= MIN_BLOCK) {
+        PUT_HDR(bp, asize, 1);
+        PUT_ALLOC_FTR(bp, asize);
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(csize - asize, 0) | PREV_ALLOC);
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(csize - asize, 0));
+        CLR_PREV_ALLOC(NEXT_BLKP(NEXT_BLKP(bp))); //the block after now follows a free block
+        seg_insert_freeblock(coalesce(NEXT_BLKP(bp))); //a shrink may leave it next to a free block
+    } else {
+        PUT_HDR(bp, csize, 1);
+        PUT_ALLOC_FTR(bp, csize);
+        SET_PREV_ALLOC(NEXT_BLKP(bp));
+    }
+    MARK_USED(NEXT_BLKP(bp));
+}
+
+/* Description of static reserve_t *reserve_find(void *bp)
+ * returns the reserve_table slot of the growing block bp, or NULL if it is not tracked.
+ */
+static reserve_t *reserve_find(void *bp) {
+    for (int i = 0; i < RESERVE_SLOTS; i++)
+        if (reserve_table[i].bp == bp)
+            return &reserve_table[i];
+    return NULL;
+}
+
+/* Description of static void reserve_drop(void *bp)
+ * stops tracking the block bp, if it is a growing block; any headroom stays in it.
+ */
+static void reserve_drop(void *bp) {
+    reserve_t *res;
+
+    if (GET_SIZE(HDRP(bp)) >= RESERVE_MIN && (res = reserve_find(bp)) != NULL)
+        res->bp = NULL;
+}
+
+/* Description of static void *reserve_note(reserve_t *res, void *bp, size_t asize)
+ * records that the block bp has just been grown for a block size of asize; res is
+ * its slot when it was tracked already. returns bp.
+ */
+static void *reserve_note(reserve_t *res, void *bp, size_t asize) {
+    int i;
+
+    if (IS_MMAPPED(bp)) { //moved to a mapping, which mem_remap grows instead
+        if (res != NULL)
+            res->bp = NULL;
+        return bp;
+    }
+    if (res == NULL) {
+        if (asize < RESERVE_MIN)
+            return bp;
+        for (i = 0; i < RESERVE_SLOTS && reserve_table[i].bp != NULL; i++)
+            ;
+        if (i == RESERVE_SLOTS) { //full : take over the next slot (its block gives its headroom back)
+            i = reserve_next;
+            reserve_next = (reserve_next + 1) % RESERVE_SLOTS;
+            reserve_trim(&reserve_table[i]);
+        }
+        res = &reserve_table[i];
+    }
+    res->bp = bp;
+    res->size = asize;
+    res->gen = extend_gen;
+    return bp;
+}
+
+/* Description of static int reserve_trim(reserve_t *res)
+ * gives the headroom of the growing block of res back to the heap (the block stays tracked).
+ * returns nonzero if there was any.
+ */
+static int reserve_trim(reserve_t *res) {
+    size_t csize, asize;
+    char *bp;
+
+    if ((bp = res->bp) == NULL)
+        return 0;
+    csize = GET_SIZE(HDRP(bp));
+    asize = res->size;
+    if (csize - asize < MIN_BLOCK)
+        return 0;
+    PUT_HDR(bp, asize, 1);
+    PUT_ALLOC_FTR(bp, asize);
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(csize - asize, 1) | PREV_ALLOC);
+    free_block(NEXT_BLKP(bp)); //the headroom coalesces like any freed block
+    return 1;
+}
+
+/* Description of static int reserve_release(int stale)
+ * gives the headroom of every growing block back to the heap, or (stale) only that of the
+ * blocks that have not grown since the last heap extension. returns nonzero if anything was released.
+ */
+static int reserve_release(int stale) {
+    int released = 0;
+
+    for (int i = 0; i < RESERVE_SLOTS; i++)
+        if (!stale || reserve_table[i].gen != extend_gen)
+            released |= reserve_trim(&reserve_table[i]);
+    return released;
+}
+
+/* Description of static void fastbin_put(void *bp, size_t size)
+ * puts a block of (at least) size bytes being freed in the fast bin of size.
+ */
+static void fastbin_put(void *bp, size_t size) {
+    *(void **) bp = fastbins[FB_INDEX(size)];
+    fastbins[FB_INDEX(size)] = bp;
+    fastbin_used = 1;
+}
+
+/* Description of static int fastbin_consolidate(void)
+ * frees (and so coalesces) every block held in the fast bins.
+ * returns nonzero if there was any.
+ */
+static int fastbin_consolidate(void) {
+    char *bp;
+
+    if (!fastbin_used)
+        return 0;
+    for (int i = 0; i < FASTBINS; i++) {
+        while ((bp = fastbins[i]) != NULL) {
+            fastbins[i] = *(void **) bp;
+            free_block(bp);
+        }
+    }
+    fastbin_used = 0;
+    return 1;
+}
+
+/* Description of static void *malloc_block(size_t asize)
+ * allocates a block of asize bytes (overhead included) from the seglist,
+ * extending the heap when no free block fits.
+ */
+static void *malloc_block(size_t asize) {
+    size_t extendsize; // the amount to extend the heap by if there's no fit
+    char *bp;
+
+    if (asize <= FASTBIN_MAX && (bp = fastbins[FB_INDEX(asize)]) != NULL) { //a block of this size was freed lately
+        fastbins[FB_INDEX(asize)] = *(void **) bp;
+        return bp;
+    }
+
+    // search the free list for a fit (again, after merging the fast bins)
+    if ((bp = find_fit(asize)) != NULL ||
+        (fastbin_consolidate() && (bp = find_fit(asize)) != NULL)) {
+        place(bp, asize);
+        return bp;
+    }
+
+    // no fit found. take back the realloc headroom of blocks that stopped growing, else extend
+    // the heap (or, if it cannot grow, take back all the realloc headroom) and place
+    extendsize = MAX(asize, CHUNKSIZE);
+    if ((!reserve_release(1) || (bp = find_fit(asize)) == NULL) &&
+        (bp = extend_heap(extendsize/WSIZE)) == NULL &&
+        (!reserve_release(0) || (bp = find_fit(asize)) == NULL))
+        return NULL;
+    place(bp, asize);
+    return bp;
+}
+
+/* Description of static void free_block(void *bp)
+ * frees an allocated block, coalesces it and puts it back in the seglist.
+ */
+static void free_block(void *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    PUT_HDR(bp, size, 0);
+    PUT(FTRP(bp), PACK(size, 0));
+    CLR_PREV_ALLOC(NEXT_BLKP(bp)); //the next block now follows a free block
+    PUT(FREE_PREV(bp), 0);
+    PUT(FREE_NEXT(bp), 0);
+    bp = coalesce(bp);
+    if (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0 && GET_SIZE(HDRP(bp)) >= TRIM_THRESHOLD)
+        trim_heap(bp); //the top block got large : give most of it back
+    seg_insert_freeblock(bp);//After coalescing, insert freed block in the seglist
+}
+
+/* Description of static void *alloc_aligned_block(size_t asize, size_t align)
+ * allocates a block of asize bytes whose block pointer is a multiple of align (a power of two).
+ * takes a free block large enough for any alignment offset, splits the leading slack off
+ * as a free block of its own (at least MIN_BLOCK bytes) and places the block after it.
+ */
+static void *alloc_aligned_block(size_t asize, size_t align) {
+    size_t search = asize + align + MIN_BLOCK; //room for the worst-case leading slack
+    size_t csize, lead;
+    char *bp, *aligned;
+
+    if ((bp = find_fit(search)) == NULL &&
+        (!fastbin_consolidate() || (bp = find_fit(search)) == NULL) &&
+        (!reserve_release(1) || (bp = find_fit(search)) == NULL) &&
+        (bp = extend_heap(MAX(search, CHUNKSIZE)/WSIZE)) == NULL &&
+        (!reserve_release(0) || (bp = find_fit(search)) == NULL))
+        return NULL;
+
+    aligned = (char *) (((unsigned long) bp + align - 1) & ~(unsigned long) (align - 1));
+    if (aligned != bp && aligned - bp < MIN_BLOCK)
+        aligned += align; //the slack must hold a free block
+    lead = aligned - bp;
+
+    if (lead) { //split [bp, aligned) off as a free block
+        csize = GET_SIZE(HDRP(bp));
+        seg_remove_freeblock(bp);
+        PUT_HDR(bp, lead, 0);
+        PUT(FTRP(bp), PACK(lead, 0));
+        seg_insert_freeblock(bp);
+        PUT(HDRP(aligned), PACK(csize - lead, 0)); //follows a free block
+        PUT(FTRP(aligned), PACK(csize - lead, 0));
+        seg_insert_freeblock(aligned);
+        bp = aligned;
+    }
+    place(bp, asize);
+    return bp;
+}
+
 static void *extend_heap(size_t words) {
     size_t size; 
-    char *bp;
-    //allocate an even number of words to maintain double word alignment
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; //the size aligned to double-word alignment (8 B)
+    char *bp, *top;
+    //allocate a multiple of ALIGNMENT bytes to keep the blocks aligned
+    size = ALIGN(words * WSIZE);
+    if (heap_grain) //up to the next huge page boundary
+        size = (mem_heapsize() + size + heap_grain - 1) / heap_grain * heap_grain - mem_heapsize();
     
+    if (size > 0x7fffffffUL) //mem_sbrk takes an int
+        return NULL;
+#if OFFSET_LINKS
+    if (mem_heapsize() + size > 0xffffffffUL) //links are 32-bit heap offsets, so the heap cannot outgrow 4 GB
+        return NULL;
+#endif
     if ((long) (bp = mem_sbrk(size)) == -1) //tries extension by the aligned size block
         return NULL; //sbrk failed.
+    STAT_INC(extends);
+    STAT_ADD(extend_bytes, size);
+    extend_gen++; //growing blocks that do not grow again before the next one get no headroom
 
     //Implemented in boundary tag scheme
     //initialize free block header/footer and the epilogue header
-    PUT(HDRP(bp), PACK(size, 0)); //new free block header
+    PUT_HDR(bp, size, 0); //new free block header (the old epilogue header keeps the prev-allocated bit)
     PUT(FTRP(bp), PACK(size, 0)); //new free block footer
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); //new epilogue header
  
-    bp = coalesce(bp); //coalesce current block by considering 4 cases.
-    seg_insert_freeblock(bp); //insert the block in seglist (find appropriate size)
+    if ((top = coalesce(bp)) != bp) { //merged into the top block : clear the old footer and header in between
+        PUT(HDRP(bp) - WSIZE, 0);
+        PUT(HDRP(bp), 0);
+    }
+    seg_insert_freeblock(top); //insert the block in seglist (find appropriate size)
 
-    return bp;
+    return top;
+}
+
+/* Description of static void trim_heap(void *bp)
+ * shrinks the heap so the free block bp at its top keeps TRIM_KEEP bytes.
+ * bp must not be in the seglist yet.
+ */
+static void trim_heap(void *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t excess = size - TRIM_KEEP;
+    size_t step, keep;
+
+    if (heap_grain) { //down to a huge page boundary
+        keep = (mem_heapsize() - excess + heap_grain - 1) / heap_grain * heap_grain;
+        excess = keep < mem_heapsize() ? mem_heapsize() - keep : 0;
+    }
+
+    while (excess > 0) { //mem_sbrk takes an int
+        step = MIN(excess, 1UL << 30);
+        if ((long) mem_sbrk(-(int) step) == -1)
+            break;
+        excess -= step;
+        size -= step;
+    }
+    PUT_HDR(bp, size, 0);
+    PUT(FTRP(bp), PACK(size, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); //new epilogue header (follows a free block)
+    if ((char *) mem_heap_dirty() < heap_clean)
+        heap_clean = mem_heap_dirty(); //the released storage reads as zero again
 }
 
 
@@ -356,39 +1427,43 @@ static void *extend_heap(size_t words) {
  */
 
 static void *coalesce(void *bp) {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp))); //allocated bit of the previous block
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp)); //allocated bit of the previous block (kept in our own header)
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp))); //allocated bit of the next block
     size_t size = GET_SIZE(HDRP(bp)); //current block's size
 
     //case 1 : previous block and next block are both allocated.
     if (prev_alloc && next_alloc) {
+        STAT_INC(coalesce[0]);
         return bp;
     }
 
     //case 2 : previous block is allocated, but next block is free
     else if (prev_alloc && !next_alloc) {
+        STAT_INC(coalesce[1]);
         seg_remove_freeblock(NEXT_BLKP(bp)); //remove the free block from the free list to update the size of the free block.
         size += GET_SIZE(HDRP(NEXT_BLKP(bp))); //logically coalesce current block with the next block
-        PUT(HDRP(bp), PACK(size, 0)); //set the size of the colaesced block (both in header and footer)
+        PUT_HDR(bp, size, 0); //set the size of the colaesced block (both in header and footer)
         PUT(FTRP(bp), PACK(size, 0));
     }
 
     //case 3 : previous block is free and the next block is allocated
     else if (!prev_alloc && next_alloc) {
+        STAT_INC(coalesce[2]);
         seg_remove_freeblock(PREV_BLKP(bp)); //remove the free block from the free list to update the size of the free block.
         size += GET_SIZE(HDRP(PREV_BLKP(bp))); //logically coalesce current block with the next block
         PUT(FTRP(bp), PACK(size, 0)); //set the size of the colaesced block (both in header and footer)
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0)); //previous block is coalesced with the current block.
+        PUT_HDR(PREV_BLKP(bp), size, 0); //previous block is coalesced with the current block.
         bp = PREV_BLKP(bp);
     }
 
     //case 4 : both are free, so merge them all
     else {
+        STAT_INC(coalesce[3]);
         seg_remove_freeblock(PREV_BLKP(bp)); //remove the free block from the free list to update the size of the free block.
         seg_remove_freeblock(NEXT_BLKP(bp)); //remove the free block from the free list to update the size of the free block.
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp))); //logically coalesce current block with the next block
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0)); //set the size of the colaesced block (both in header and footer)
         PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0)); //set the size of the colaesced block (both in header and footer)
+        PUT_HDR(PREV_BLKP(bp), size, 0); //set the size of the colaesced block (both in header and footer)
         bp = PREV_BLKP(bp);
     }
 
@@ -398,53 +1473,86 @@ static void *coalesce(void *bp) {
 
 
 
+/* Description of static void *find_fit(size_t req_size)
+ * first searches the size group containing req_size (its blocks may or may not fit).
+ * otherwise rounds req_size up to the next second-level boundary, so that every block
+ * in the resulting size group (or any larger one) fits, and searches the first
+ * non-empty group at or above it. each search looks at no more than FIT_SCAN blocks,
+ * so this runs in bounded time.
+ * returns NULL if no free block is large enough.
+ */
 static void *find_fit(size_t req_size) {
 
-    int max_listsize = 16;
-    //int size_group = get_size_class(asize);    
-    void *bp;
-    int tmpSize = req_size; //get the size of the current block.
-    int exceeds = 0; //if remainder occurs, then that block needs one level higher than that of the current size group.
-    int size_group = 0; //counting where the block belongs in seglist.
-     
-    for (; tmpSize > 16 && size_group < 15; tmpSize /= 2, size_group++) {
-        //printf("tmpsize : %d\n", tmpSize);
-        if (tmpSize % 2)
-        	exceeds = 1; //set the exceeds bit if a remainder occurs when divided by 2
-    }
-
-    if (exceeds && tmpSize == 16 && size_group < 15)
-        size_group++; //one level higher than the computed group
-
-    char **ptr;
-    for (int i = size_group; i < max_listsize; i++) {
-	    ptr = seg_listp + i;
-	    if (*ptr) {
-		 bp = (void *)GET(ptr);
-		 for (;bp!=NULL; bp = FREE_NEXT_BLKP(bp)) {
-			if (GET_SIZE(HDRP(bp)) >= req_size) {
-			       return bp; //find first fit
-			}
-		 }
-	   }
-    }	   
- 
-    return NULL; // no fit found
+    int msb = 31 - __builtin_clz(req_size); //most significant bit of the request
+    int size_group, fl, sl;
+    unsigned int sl_map, fl_map;
+    size_t search_size; //req_size rounded up to a group boundary
+    char *bp;
+
+    STAT_INC(fit_searches);
+    bp = best_in_group(GET_LINK(SEG_HEAD(seg_index(req_size))), req_size);
+
+    if (bp != NULL)
+        return bp; //a block of the exact group fits
+
+    search_size = req_size + (1U << (msb - SL_SHIFT)) - 1; //round up to the next second-level boundary
+    if (search_size > 0xffffffffUL)
+        return NULL;
+    size_group = seg_index(search_size);
+    fl = size_group / SL_COUNT;
+    sl = size_group % SL_COUNT;
+
+    sl_map = sl_bitmap[fl] & (~0U << sl); //non-empty groups of this class at or above sl
+    if (!sl_map) {
+        fl_map = fl_bitmap & (~0U << (fl + 1)); //non-empty classes above fl
+        if (!fl_map)
+            return NULL; // no fit found
+        fl = __builtin_ffs(fl_map) - 1;
+        sl_map = sl_bitmap[fl];
+    }
+    sl = __builtin_ffs(sl_map) - 1;
+
+    return best_in_group(GET_LINK(SEG_HEAD(fl * SL_COUNT + sl)), req_size);
+}
+
+/* Description of static void *best_in_group(char *bp, size_t req_size)
+ * walks at most FIT_SCAN blocks of a free list starting at bp and returns the smallest
+ * one of at least req_size bytes (stopping early on an exact fit), or NULL if none fits.
+ */
+static void *best_in_group(char *bp, size_t req_size) {
+    char *best = NULL;
+    size_t best_size = 0;
+    size_t bsize;
+
+    STAT_INC(fit_groups);
+    for (int i = 0; bp != NULL && i < FIT_SCAN; bp = FREE_NEXT_BLKP(bp), i++) {
+        STAT_INC(fit_probes);
+        bsize = GET_SIZE(HDRP(bp));
+        if (bsize >= req_size && (best == NULL || bsize < best_size)) {
+            best = bp;
+            best_size = bsize;
+            if (bsize == req_size)
+                break; //cannot do better than an exact fit
+        }
+    }
+    return best;
 }
 
 static void place(void *bp, size_t asize) {
 
     size_t csize = GET_SIZE(HDRP(bp));
 
-    if ((csize - asize) >= 2*DSIZE) { 
+    if ((csize - asize) >= MIN_BLOCK) { 
 
+        STAT_INC(splits);
         seg_remove_freeblock(bp); //the remaining free block can be inserted into the seglist, so remove the whole free block first.
 
 	// the part for placing the block into a free block when asize <= csize
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
+        PUT_HDR(bp, asize, 1);
+        PUT_ALLOC_FTR(bp, asize);
         bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(csize - asize, 0));
+        MARK_USED(bp);
+        PUT(HDRP(bp), PACK(csize - asize, 0) | PREV_ALLOC);
         PUT(FTRP(bp), PACK(csize - asize, 0));
 
         // splice out prev and next free block from the seglist to insert the block
@@ -454,41 +1562,34 @@ static void place(void *bp, size_t asize) {
         seg_insert_freeblock(bp); //insert a new block into the seglist.
     } else {
         seg_remove_freeblock(bp); //remove the whole free block from the seglist first.
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
+        PUT_HDR(bp, csize, 1);
+        PUT_ALLOC_FTR(bp, csize);
+        SET_PREV_ALLOC(NEXT_BLKP(bp)); //the next block now follows an allocated block
+        MARK_USED(NEXT_BLKP(bp));
     }
 }
 
 static void seg_insert_freeblock(void *bp) {
     
     size_t size = GET_SIZE(HDRP(bp)); // adjusted size
-    char **sizegroup_header; // the pointer to the address of the first free block of the size class
-    int exceeds = 0;
-    int size_group = 0;
-    int tmpSize = size;
-
-    for (; tmpSize > 16 && size_group < 15; tmpSize /= 2, size_group++) {
-        //printf("tmpsize : %d\n", tmpSize);
-        if (tmpSize % 2)
-                exceeds = 1; //set the exceeds bit if a remainder occurs when divided by 2
-    }
+    char *sizegroup_header; // the pointer to the address of the first free block of the size class
+    int size_group = seg_index(size); //the group whose range contains size
 
-    if (exceeds && tmpSize == 16 && size_group < 15)
-        size_group++; //one level higher than the computed group
-
-    sizegroup_header = seg_listp + size_group;
+    sizegroup_header = SEG_HEAD(size_group);
+    fl_bitmap |= 1U << (size_group / SL_COUNT); //mark the group as non-empty
+    sl_bitmap[size_group / SL_COUNT] |= 1U << (size_group % SL_COUNT);
  
-    if (!(*sizegroup_header)) { // if the header for a specific size group of the seglist is empty..
-        PUT(sizegroup_header, (unsigned int) bp); //let the header point to the new free block being inserted (bp)
-        PUT(FREE_PREV(bp), (unsigned int) sizegroup_header); //let bp->prev point to the header 
+    if (!GET(sizegroup_header)) { // if the header for a specific size group of the seglist is empty..
+        PUT_LINK(sizegroup_header, bp); //let the header point to the new free block being inserted (bp)
+        PUT_LINK(FREE_PREV(bp), sizegroup_header); //let bp->prev point to the header 
         PUT(FREE_NEXT(bp), 0); //let bp->next point NULL (end of the list)
     }
     
     else { // if the header for a specific size group of the seglist is not empty..
-        PUT(FREE_PREV(bp), (unsigned int) sizegroup_header); //let bp->prev point to the header
+        PUT_LINK(FREE_PREV(bp), sizegroup_header); //let bp->prev point to the header
         PUT(FREE_NEXT(bp), GET(sizegroup_header)); //let bp->next point to the next block of the header
-        PUT(FREE_PREV(GET(sizegroup_header)), (unsigned int) bp); //let (the next block of the header)->prev point to bp
-        PUT(sizegroup_header, (unsigned int) bp); //let header point to bp
+        PUT_LINK(FREE_PREV(GET_LINK(sizegroup_header)), bp); //let (the next block of the header)->prev point to bp
+        PUT_LINK(sizegroup_header, bp); //let header point to bp
     }
 }
 
@@ -496,20 +1597,19 @@ static void seg_remove_freeblock(void *bp) {
  
     //need to check whether the previous block and the next block exists in free list.
     //If the previous block exists, it will point to the heap space outside the seglist. If not, it points to the ptr in seglist.
-    int seglist_size = 16;
-    void *prev = FREE_PREV_BLKP(bp); //points to the previous block in the seglist header	
-    void *next = FREE_NEXT_BLKP(bp); //points to the next block in the seglist header
+    char *prev = FREE_PREV_BLKP(bp); //points to the previous block in the seglist header	
+    char *next = FREE_NEXT_BLKP(bp); //points to the next block in the seglist header
     int prev_exists = 0, next_exists = 0;
 
 
-    unsigned int list_start_addr = (unsigned int) seg_listp;
-    unsigned int list_end_addr = (list_start_addr + (unsigned int)((seglist_size - 1)*WSIZE));
+    char *list_start_addr = seg_listp;
+    char *list_end_addr = SEG_HEAD(SEGLIST_SIZE - 1);
  
     //determine if the previous block exists and set flag accordingly.
-    if ((unsigned int) prev < list_start_addr || (unsigned int) prev > list_end_addr) {
+    if (prev < list_start_addr || prev > list_end_addr) {
 	prev_exists = 1;
     }
-    else if ((unsigned int) (list_end_addr - (unsigned int) prev) % WSIZE) {
+    else if ((list_end_addr - prev) % WSIZE) {
 	prev_exists = 1;
     }
     if (next) 
@@ -520,17 +1620,22 @@ static void seg_remove_freeblock(void *bp) {
     } // if bp is allocated, do not remove block. (wrong operation)
 
     if (!prev_exists && !next_exists) { // case 1 : if this is the first block in the seglist header
-        PUT(prev, (unsigned int) next);
+        int size_group = (prev - seg_listp) / WSIZE;
+        PUT(prev, 0);
+        //the group became empty, so clear its bit (and the class bit once the whole class is empty)
+        sl_bitmap[size_group / SL_COUNT] &= ~(1U << (size_group % SL_COUNT));
+        if (!sl_bitmap[size_group / SL_COUNT])
+            fl_bitmap &= ~(1U << (size_group / SL_COUNT));
     }
 
     else if (!prev_exists && next_exists) { // case 2 : if this is the first block, and has a block next to it
-        PUT(prev, (unsigned int) next);
-        PUT(FREE_PREV(next), (unsigned int) prev);
+        PUT_LINK(prev, next);
+        PUT_LINK(FREE_PREV(next), prev);
     }
 
     else if (prev_exists && next_exists) { // case 3 : if this is not the first block, and has a block next to it
-        PUT(FREE_NEXT(prev), (unsigned int) next);
-        PUT(FREE_PREV(next), (unsigned int) prev);
+        PUT_LINK(FREE_NEXT(prev), next);
+        PUT_LINK(FREE_PREV(next), prev);
     }
 
     else { //case 4 : if this is the last block in the seglist header
@@ -542,4 +1647,250 @@ static void seg_remove_freeblock(void *bp) {
     PUT(FREE_NEXT(bp), 0);
 }
 
+/* Description of static int seg_index(size_t size)
+ * returns the seglist size group whose range contains size (size >= MIN_BLOCK).
+ */
+static int seg_index(size_t size) {
+    int msb = 31 - __builtin_clz(size); //floor(log2(size))
+    int fl = msb - FL_MIN;
+    int sl = (size >> (msb - SL_SHIFT)) & (SL_COUNT - 1); //the SL_SHIFT bits below the msb
+
+    return fl * SL_COUNT + sl;
+}
+
+/* Description of static void *slab_alloc(size_t size)
+ * returns a free object of the class of size (1 <= size <= SLAB_MAX), taking a new run
+ * from the heap when every run of the class is full.
+ */
+static void *slab_alloc(size_t size) {
+    int cls = ALIGN(size) / ALIGNMENT; //class index, objects of cls * ALIGNMENT bytes
+    slab_run_t *run = SLAB_PARTIAL[cls];
+    unsigned int objsize = cls * ALIGNMENT;
+    int w, slot;
+    char *bp;
+
+    if (run == NULL) { //every run is full; carve a new one
+        if ((bp = alloc_aligned_block(RUN_SIZE, RUN_SIZE)) == NULL)
+            return NULL;
+        run = (slab_run_t *) bp;
+#ifdef MM_THREADS
+        run->owner = my_cache;
+#endif
+        run->objsize = objsize;
+        run->nslots = (RUN_SIZE - WSIZE - RUN_HDR_SIZE) / objsize; //the block header precedes the run
+        run->nfree = run->nslots;
+        memset(run->free_map, 0, sizeof(run->free_map));
+        for (slot = 0; slot < (int) run->nslots; slot++)
+            run->free_map[slot / 32] |= 1U << (slot % 32);
+        run->prev = NULL;
+        run->next = NULL;
+        SLAB_PARTIAL[cls] = run;
+
+        slab_map[RUN_INDEX(bp) / 32] |= 1U << (RUN_INDEX(bp) % 32); //mark the run in the slab map
+        if (RUN_INDEX(bp) >= slab_map_top)
+            slab_map_top = RUN_INDEX(bp) + 1;
+    }
+
+    for (w = 0; !run->free_map[w]; w++) //the run has a free slot, so this terminates
+        ;
+    slot = w * 32 + __builtin_ffs(run->free_map[w]) - 1;
+    run->free_map[w] &= ~(1U << (slot % 32));
+
+    if (--run->nfree == 0) { //the run is full now; take it off the partial list
+        SLAB_PARTIAL[cls] = run->next;
+        if (run->next)
+            run->next->prev = NULL;
+    }
+    return RUN_OBJS(run) + slot * objsize;
+}
+
+/* Description of static slab_run_t *slab_free(void *p)
+ * returns a slab object to its run, which belongs to the calling thread (or there are
+ * no threads). a run that becomes empty is taken off the partial list and returned, for
+ * the caller to give back with slab_release, unless it is the only run of its class
+ * with free slots. returns NULL otherwise.
+ */
+static slab_run_t *slab_free(void *p) {
+    slab_run_t *run = RUN_OF(p);
+    int cls = run->objsize / ALIGNMENT;
+    int slot = ((char *) p - RUN_OBJS(run)) / run->objsize;
+
+    run->free_map[slot / 32] |= 1U << (slot % 32);
+
+    if (run->nfree++ == 0) { //the run was full; it has a free slot again
+        run->prev = NULL;
+        run->next = SLAB_PARTIAL[cls];
+        if (run->next)
+            run->next->prev = run;
+        SLAB_PARTIAL[cls] = run;
+    }
+
+    if (run->nfree == run->nslots && (run->prev || run->next)) { //empty and not the last partial run
+        if (run->prev)
+            run->prev->next = run->next;
+        else
+            SLAB_PARTIAL[cls] = run->next;
+        if (run->next)
+            run->next->prev = run->prev;
+        return run;
+    }
+    return NULL;
+}
+
+/* Description of static void slab_release(slab_run_t *run)
+ * gives an empty run back to the heap; the caller holds the lock.
+ */
+static void slab_release(slab_run_t *run) {
+    slab_map[RUN_INDEX(run) / 32] &= ~(1U << (RUN_INDEX(run) % 32));
+    free_block(run);
+}
+
+/* Description of static void slab_put(void *p, int locked)
+ * frees slab object p from any thread. locked tells whether the caller holds the lock.
+ * objects of another thread's run go on that thread's remote_frees stack.
+ */
+static void slab_put(void *p, int locked) {
+    slab_run_t *run = RUN_OF(p);
+
+#ifdef MM_THREADS
+    if (run->owner != my_cache) {
+        remote_free(run->owner, p);
+        return;
+    }
+#endif
+    if ((run = slab_free(p)) != NULL) {
+        if (!locked)
+            LOCK();
+        slab_release(run);
+        if (!locked)
+            UNLOCK();
+    }
+}
+
+/* Description of static void *map_block(size_t size)
+ * allocates a large block in a mapping of its own.
+ */
+static void *map_block(size_t size) {
+    char *p;
+
+    if (size > MAP_MAX - MAP_HDR) //the length would not fit the header
+        return NULL;
+    if ((p = mem_map(ALIGN(size + MAP_HDR))) == NULL)
+        return NULL;
+    PUT(p + MAP_HDR - WSIZE, PACK(ALIGN(size + MAP_HDR), 1 | MMAPPED));
+    return p + MAP_HDR;
+}
+
+/* Description of static void *remap_block(void *bp, size_t size)
+ * resizes a mapped block to hold size bytes; the mapping may move. returns NULL
+ * (leaving the block as it was) on failure.
+ */
+static void *remap_block(void *bp, size_t size) {
+    char *p;
+
+    if (size > MAP_MAX - MAP_HDR)
+        return NULL;
+    if ((p = mem_remap(MAP_BASE(bp), ALIGN(size + MAP_HDR))) == NULL)
+        return NULL;
+    PUT(p + MAP_HDR - WSIZE, PACK(ALIGN(size + MAP_HDR), 1 | MMAPPED));
+    return p + MAP_HDR;
+}
+
+#ifdef MM_THREADS
+/* Description of static thread_cache_t *tcache_get(void)
+ * returns the calling thread's cache. on first use (and after mm_init) the thread adopts
+ * the cache of an exited thread, or a new one is allocated from the heap.
+ * returns NULL if the heap has no room for a new cache.
+ */
+static thread_cache_t *tcache_get(void) {
+    if (my_cache == NULL || my_gen != heap_gen) { //first call on this thread, or the heap was reset
+        LOCK();
+        if ((my_cache = orphan_caches) != NULL) //adopt a cache along with its runs
+            orphan_caches = my_cache->next_orphan;
+        else if ((my_cache = do_malloc(sizeof(thread_cache_t))) != NULL)
+            memset(my_cache, 0, sizeof(thread_cache_t));
+        my_gen = heap_gen;
+        UNLOCK();
+        if (my_cache != NULL) {
+            pthread_once(&tcache_once, tcache_key_init);
+            pthread_setspecific(tcache_key, my_cache); //so the cache is retired when the thread exits
+        }
+    }
+    return my_cache;
+}
+
+/* Description of static int tcache_put(thread_cache_t *tc, void *bp, size_t size)
+ * caches a (non-slab) block of size bytes being freed in its bin (a block larger than size
+ * is fine there). returns 0 if the block is too large for the cache or the bin is full,
+ * in which case the caller frees it to the heap.
+ */
+static int tcache_put(thread_cache_t *tc, void *bp, size_t size) {
+    size_t idx = TC_INDEX(size);
+
+    if (size < ADJUST_SIZE(SLAB_MAX + 1) || size > TCACHE_MAX || tc->counts[idx] >= TCACHE_FILL)
+        return 0; //(smaller blocks left over by realloc do not match any bin)
+    *(void **) bp = tc->bins[idx];
+    tc->bins[idx] = bp;
+    tc->counts[idx]++;
+    return 1;
+}
 
+/* Description of static void tcache_flush(void *arg)
+ * key destructor : returns the blocks cached by an exiting thread to the heap and
+ * leaves its cache (with its slab runs and remote_frees) for the next new thread.
+ */
+static void tcache_flush(void *arg) {
+    thread_cache_t *tc = arg;
+    void *bp;
+
+    LOCK();
+    if (my_gen == heap_gen) { //a cache of an older heap is already gone
+        for (int i = 0; i <= TCACHE_BINS; i++) {
+            while ((bp = tc->bins[i]) != NULL) {
+                tc->bins[i] = *(void **) bp;
+                free_block(bp);
+            }
+            tc->counts[i] = 0;
+        }
+        tc->next_orphan = orphan_caches;
+        orphan_caches = tc;
+    }
+    my_cache = NULL;
+    UNLOCK();
+}
+
+/* Description of static void remote_free(thread_cache_t *owner, void *p)
+ * pushes slab object p on the remote_frees stack of the cache owning its run (lock-free).
+ */
+static void remote_free(thread_cache_t *owner, void *p) {
+    void *head = __atomic_load_n(&owner->remote_frees, __ATOMIC_RELAXED);
+
+    do {
+        *(void **) p = head;
+    } while (!__atomic_compare_exchange_n(&owner->remote_frees, &head, p, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Description of static void slab_drain(thread_cache_t *tc)
+ * takes the whole remote_frees stack of the calling thread's cache in one exchange and
+ * returns its objects to their runs.
+ */
+static void slab_drain(thread_cache_t *tc) {
+    void *p = __atomic_exchange_n(&tc->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    void *next;
+    slab_run_t *run;
+
+    for (; p != NULL; p = next) {
+        next = *(void **) p;
+        if ((run = slab_free(p)) != NULL) {
+            LOCK();
+            slab_release(run);
+            UNLOCK();
+        }
+    }
+}
+
+static void tcache_key_init(void) {
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+#endif
@@ -4,6 +4,45 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void mm_free_sized(void *ptr, size_t size);
+extern size_t mm_usable_size(void *ptr);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+extern int mm_check(void);
+extern void mm_atfork_prepare(void);
+extern void mm_atfork_parent(void);
+extern void mm_atfork_child(void);
+
+/*
+ * Counters kept by an allocator built with -DMM_STATS (e.g. "make
+ * MMFLAGS=-DMM_STATS"); mm_init clears them. mm_stats copies them out
+ * and returns 0, or returns -1 if the allocator keeps no counters.
+ */
+#define MM_STATS_CLASSES 28 /* power-of-two size classes, from 16 B up */
+
+typedef struct {
+    unsigned long malloc_calls;   /* mm_malloc (and each block of a batch) */
+    unsigned long free_calls;     /* mm_free, mm_free_sized, mm_free_batch blocks */
+    unsigned long realloc_calls;
+    unsigned long calloc_calls;
+    unsigned long memalign_calls; /* mm_memalign and its wrappers */
+    unsigned long fit_searches;   /* find_fit calls */
+    unsigned long fit_groups;     /* free lists (size groups) looked into */
+    unsigned long fit_probes;     /* free blocks examined */
+    unsigned long splits;         /* free blocks split by place */
+    unsigned long coalesce[4];    /* coalesce cases 1 to 4 */
+    unsigned long extends;        /* extend_heap calls */
+    unsigned long extend_bytes;   /* bytes they added to the heap */
+    unsigned long realloc_inplace;/* reallocs that kept (or slid) the block */
+    unsigned long realloc_copy;   /* reallocs that copied to a new block */
+    unsigned long free_blocks[MM_STATS_CLASSES]; /* free-list lengths per class, now */
+} mm_stats_t;
+
+extern int mm_stats(mm_stats_t *stats);
 
 
 /* 
@@ -0,0 +1,140 @@
+/*
+ * preload.c - libc allocator entry points on top of the mm package, for the
+ *             LD_PRELOAD build (make libmm.so):
+ *
+ *                 LD_PRELOAD=./libmm.so ls -l
+ *
+ *             The library is built with MM_THREADS, and memlib reserves a
+ *             4 GB heap for it (MEM_HEAP). No call ends up in libc malloc.
+ *             The heap is set up on the first call. Only the functions below
+ *             are exported; mm_* and mem_* stay hidden so they cannot clash
+ *             with names in the program.
+ *
+ *             mm.c is built with -DMM_ALIGNMENT=16, so blocks have the alignment
+ *             of libc malloc on 64-bit, which SSE code and long double rely
+ *             on. The heap lock is held across fork, so the child gets a
+ *             consistent heap.
+ */
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+static pthread_once_t mm_once = PTHREAD_ONCE_INIT;
+static int mm_ready = 0; // set once the heap is up
+
+static void preload_init(void) {
+    mem_init();
+    if (mm_init() == 0)
+        __atomic_store_n(&mm_ready, 1, __ATOMIC_RELEASE);
+}
+
+/* Description of static void preload_atfork(void)
+ * registers the fork handlers as the library is loaded (pthread_atfork may call malloc,
+ * so not from preload_init).
+ */
+__attribute__((constructor)) static void preload_atfork(void) {
+    pthread_atfork(mm_atfork_prepare, mm_atfork_parent, mm_atfork_child);
+}
+
+/* Description of static int ready(void)
+ * sets up the heap on the first call. returns 0 (with errno ENOMEM) if that failed.
+ */
+static inline int ready(void) {
+    if (__atomic_load_n(&mm_ready, __ATOMIC_ACQUIRE))
+        return 1;
+    pthread_once(&mm_once, preload_init);
+    if (!mm_ready)
+        errno = ENOMEM;
+    return mm_ready;
+}
+
+/* Description of static void *checked(void *bp)
+ * libc reports a failed allocation with errno ENOMEM; mm does not always set it.
+ */
+static inline void *checked(void *bp) {
+    if (bp == NULL)
+        errno = ENOMEM;
+    return bp;
+}
+
+EXPORT void *malloc(size_t size) {
+    if (!ready())
+        return NULL;
+    return checked(mm_malloc(size ? size : 1)); //malloc(0) must give a unique pointer
+}
+
+EXPORT void free(void *ptr) {
+    if (ptr != NULL)
+        mm_free(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size) {
+    if (!ready())
+        return NULL;
+    if (nmemb == 0 || size == 0)
+        nmemb = size = 1;
+    return checked(mm_calloc(nmemb, size));
+}
+
+EXPORT void *realloc(void *ptr, size_t size) {
+    void *bp;
+
+    if (!ready())
+        return NULL;
+    if (ptr == NULL)
+        return malloc(size);
+    if ((bp = mm_realloc(ptr, size)) == NULL && size > 0)
+        errno = ENOMEM; //the old block is left alone
+    return bp;
+}
+
+EXPORT void *reallocarray(void *ptr, size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > (size_t) -1 / size) { //nmemb * size overflows
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+EXPORT void *memalign(size_t alignment, size_t size) {
+    if (!ready())
+        return NULL;
+    if (alignment & (alignment - 1)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return checked(mm_memalign(alignment, size ? size : 1));
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (!ready())
+        return ENOMEM;
+    return mm_posix_memalign(memptr, alignment, size ? size : 1);
+}
+
+EXPORT void *valloc(size_t size) {
+    return memalign(mem_pagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size) {
+    size_t page = mem_pagesize();
+
+    if (size > (size_t) -1 - page) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr) {
+    return ptr != NULL ? mm_usable_size(ptr) : 0;
+}
@@ -0,0 +1,544 @@
+/*
+ * trace.c - loading and writing trace files (see trace.h).
+ *
+ * trace_load tells the two forms apart by the magic number at the
+ * start of the file, so mdriver (and tracebin) take either one.
+ * Errors are reported on stderr and returned as -1.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024   /* max string size */
+
+/*
+ * check_op - check that request n is well formed
+ */
+static int check_op(const char *path, const trace_header_t *hdr,
+		    const traceop_t *op, int n)
+{
+    if (op->type < ALLOC || op->type > MEMALIGN) {
+	fprintf(stderr, "Bogus request type (%d) in tracefile %s\n",
+		op->type, path);
+	return -1;
+    }
+    if (op->index < 0 || op->index >= hdr->num_ids) {
+	fprintf(stderr, "Bad index (%d) in request %d of tracefile %s\n",
+		op->index, n, path);
+	return -1;
+    }
+    if (op->type == MEMALIGN &&
+	(op->align <= 0 || (op->align & (op->align - 1)))) {
+	fprintf(stderr, "Bad alignment (%d) in tracefile %s\n",
+		op->align, path);
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * trace_check - check that every request is well formed and that the
+ *     ids are exactly 0..num_ids-1, as the driver assumes
+ */
+static int trace_check(const char *path, const trace_header_t *hdr,
+		       const traceop_t *ops)
+{
+    int i, max_index = -1;
+
+    if (hdr->num_ids < 0 || hdr->num_ops < 0) {
+	fprintf(stderr, "Bad request counts in tracefile %s\n", path);
+	return -1;
+    }
+    for (i = 0; i < hdr->num_ops; i++) {
+	if (check_op(path, hdr, &ops[i], i) < 0)
+	    return -1;
+	if (ops[i].type != FREE && ops[i].index > max_index)
+	    max_index = ops[i].index;
+    }
+    if (max_index != hdr->num_ids - 1) {
+	fprintf(stderr, "Tracefile %s has %d ids, but uses %d\n",
+		path, hdr->num_ids, max_index + 1);
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * read_rep_header - read the four header numbers of a text trace
+ */
+static int read_rep_header(FILE *fp, const char *path, trace_header_t *hdr)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = TRACE_MAGIC;
+    hdr->version = TRACE_VERSION;
+    if (fscanf(fp, "%d %d %d %d", &hdr->sugg_heapsize, &hdr->num_ids,
+	       &hdr->num_ops, &hdr->weight) != 4 ||
+	hdr->num_ids < 0 || hdr->num_ops < 0) {
+	fprintf(stderr, "Bad header in tracefile %s\n", path);
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * read_rep_op - parse request n of a text trace into *op. Returns 1,
+ *     0 at the end of the file, or -1 on a garbled request.
+ */
+static int read_rep_op(FILE *fp, const char *path, traceop_t *op, int n)
+{
+    char type[MAXLINE];
+    unsigned index, size = 0, align = 0;
+
+    if (fscanf(fp, "%1023s", type) == EOF)
+	return 0;
+    switch (type[0]) {
+    case 'a':
+    case 'r':
+	if (fscanf(fp, "%u %u", &index, &size) != 2)
+	    goto garbled;
+	op->type = type[0] == 'a' ? ALLOC : REALLOC;
+	break;
+    case 'm':
+	if (fscanf(fp, "%u %u %u", &index, &align, &size) != 3)
+	    goto garbled;
+	op->type = MEMALIGN;
+	break;
+    case 'f':
+	if (fscanf(fp, "%u", &index) != 1)
+	    goto garbled;
+	op->type = FREE;
+	break;
+    default:
+	fprintf(stderr, "Bogus type character (%c) in tracefile %s\n",
+		type[0], path);
+	return -1;
+    }
+    op->index = index;
+    op->size = size;
+    op->align = align;
+    return 1;
+
+ garbled:
+    fprintf(stderr, "Garbled request %d in tracefile %s\n", n, path);
+    return -1;
+}
+
+/*
+ * read_rep - parse a text trace from fp into a malloc'd ops array
+ */
+static int read_rep(FILE *fp, const char *path, trace_header_t *hdr,
+		    traceop_t **opsp)
+{
+    traceop_t *ops, op;
+    int n = 0, rc;
+
+    if (read_rep_header(fp, path, hdr) < 0)
+	return -1;
+    if ((ops = calloc(hdr->num_ops ? hdr->num_ops : 1,
+		      sizeof(traceop_t))) == NULL) {
+	fprintf(stderr, "Out of memory reading tracefile %s\n", path);
+	return -1;
+    }
+
+    while ((rc = read_rep_op(fp, path, &op, n)) > 0) {
+	if (n == hdr->num_ops) {
+	    fprintf(stderr, "Tracefile %s has more than %d requests\n",
+		    path, hdr->num_ops);
+	    goto bad;
+	}
+	ops[n++] = op;
+    }
+    if (rc < 0)
+	goto bad;
+    if (n != hdr->num_ops) {
+	fprintf(stderr, "Tracefile %s has %d requests, not %d\n",
+		path, n, hdr->num_ops);
+	goto bad;
+    }
+    *opsp = ops;
+    return 0;
+
+ bad:
+    free(ops);
+    return -1;
+}
+
+/*
+ * get_varint - decode one unsigned LEB128 number from *p (below end)
+ */
+static int get_varint(const unsigned char **p, const unsigned char *end,
+		      int32_t *val)
+{
+    uint32_t v = 0;
+    int shift;
+
+    for (shift = 0; shift < 35 && *p < end; shift += 7) {
+	unsigned char c = *(*p)++;
+	v |= (uint32_t) (c & 0x7f) << shift;
+	if (!(c & 0x80)) {
+	    *val = (int32_t) v;
+	    return 0;
+	}
+    }
+    return -1;
+}
+
+/*
+ * put_varint - write v to fp as an unsigned LEB128 number
+ */
+static void put_varint(FILE *fp, uint32_t v)
+{
+    while (v >= 0x80) {
+	putc((v & 0x7f) | 0x80, fp);
+	v >>= 7;
+    }
+    putc(v, fp);
+}
+
+/*
+ * get_op - decode one varint-encoded request from *p (below end)
+ */
+static int get_op(const unsigned char **p, const unsigned char *end,
+		  traceop_t *op)
+{
+    if (*p == end)
+	return -1;
+    op->type = *(*p)++;
+    op->size = op->align = 0;
+    if (get_varint(p, end, &op->index) < 0)
+	return -1;
+    if (op->type != FREE && get_varint(p, end, &op->size) < 0)
+	return -1;
+    if (op->type == MEMALIGN && get_varint(p, end, &op->align) < 0)
+	return -1;
+    return 0;
+}
+
+/*
+ * decode_varint - expand the varint-encoded requests in [p, end) into a
+ *     malloc'd ops array
+ */
+static int decode_varint(const char *path, const trace_header_t *hdr,
+			 const unsigned char *p, const unsigned char *end,
+			 traceop_t **opsp)
+{
+    traceop_t *ops;
+    int i;
+
+    if ((ops = calloc(hdr->num_ops ? hdr->num_ops : 1,
+		      sizeof(traceop_t))) == NULL) {
+	fprintf(stderr, "Out of memory reading tracefile %s\n", path);
+	return -1;
+    }
+    for (i = 0; i < hdr->num_ops; i++)
+	if (get_op(&p, end, &ops[i]) < 0)
+	    break;
+    if (i < hdr->num_ops || p != end) {
+	fprintf(stderr, "Tracefile %s is truncated or garbled\n", path);
+	free(ops);
+	return -1;
+    }
+    *opsp = ops;
+    return 0;
+}
+
+/*
+ * trace_load - read the trace at path. On success the header is in
+ *     *hdr and the requests in *ops. For a fixed-width binary trace *ops
+ *     points into the mapped file, which is returned in *map and
+ *     *map_len; otherwise *map is NULL and *ops was malloc'd. Either
+ *     way, trace_unload releases it.
+ */
+int trace_load(const char *path, trace_header_t *hdr, traceop_t **ops,
+	       void **map, size_t *map_len)
+{
+    struct stat st;
+    unsigned char *base;
+    size_t len;
+    int fd, rc;
+
+    *ops = NULL;
+    *map = NULL;
+    *map_len = 0;
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+	perror(path);
+	if (fd >= 0)
+	    close(fd);
+	return -1;
+    }
+    len = st.st_size;
+
+    /* Text traces start with the header numbers, never with the magic */
+    if (len < sizeof(trace_header_t) ||
+	pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+	hdr->magic != TRACE_MAGIC) {
+	FILE *fp = fdopen(fd, "r");
+
+	if (fp == NULL) {
+	    perror(path);
+	    close(fd);
+	    return -1;
+	}
+	rc = read_rep(fp, path, hdr, ops);
+	fclose(fp);
+	if (rc == 0 && (rc = trace_check(path, hdr, *ops)) < 0) {
+	    free(*ops);
+	    *ops = NULL;
+	}
+	return rc;
+    }
+
+    if (hdr->version != TRACE_VERSION || hdr->num_ops < 0 ||
+	(hdr->flags & ~TRACE_VARINT)) {
+	fprintf(stderr, "Unsupported binary tracefile %s\n", path);
+	close(fd);
+	return -1;
+    }
+    base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+	perror(path);
+	return -1;
+    }
+
+    if (hdr->flags & TRACE_VARINT) {
+	rc = decode_varint(path, hdr, base + sizeof(*hdr), base + len, ops);
+	munmap(base, len);
+	if (rc == 0 && (rc = trace_check(path, hdr, *ops)) < 0) {
+	    free(*ops);
+	    *ops = NULL;
+	}
+	return rc;
+    }
+
+    if (len != sizeof(*hdr) + (size_t) hdr->num_ops * sizeof(traceop_t)) {
+	fprintf(stderr, "Tracefile %s should hold %d requests\n",
+		path, hdr->num_ops);
+	munmap(base, len);
+	return -1;
+    }
+    *ops = (traceop_t *) (base + sizeof(*hdr));
+    if (trace_check(path, hdr, *ops) < 0) {
+	munmap(base, len);
+	*ops = NULL;
+	return -1;
+    }
+    *map = base;
+    *map_len = len;
+    return 0;
+}
+
+/*
+ * trace_unload - release the requests returned by trace_load
+ */
+void trace_unload(traceop_t *ops, void *map, size_t map_len)
+{
+    if (map != NULL)
+	munmap(map, map_len);
+    else
+	free(ops);
+}
+
+/*
+ * The following routines read a trace a chunk at a time, for replaying
+ * traces too big to load. Each request is checked as it is read, but
+ * not against the ids the others use.
+ */
+
+/* How a stream's requests are encoded */
+enum {TEXT_FORM, FIXED_FORM, VARINT_FORM};
+
+#define VARINT_BUF 65536  /* bytes of varint-encoded requests buffered */
+#define VARINT_OP     16  /* most bytes one varint-encoded request takes */
+
+struct trace_stream {
+    FILE *fp;
+    char *path;
+    trace_header_t hdr;
+    int form;             /* TEXT_FORM, FIXED_FORM or VARINT_FORM */
+    int n;                /* number of requests read so far */
+    unsigned char *buf;   /* VARINT_FORM: bytes read from fp ... */
+    size_t lo, hi;        /* ... of which buf[lo..hi) are not decoded yet */
+};
+
+/*
+ * trace_open - open the trace at path for trace_read and put its
+ *     header in *hdr. Returns NULL on an error.
+ */
+trace_stream_t *trace_open(const char *path, trace_header_t *hdr)
+{
+    trace_stream_t *ts;
+
+    if ((ts = calloc(1, sizeof(*ts))) == NULL ||
+	(ts->path = strdup(path)) == NULL) {
+	fprintf(stderr, "Out of memory opening tracefile %s\n", path);
+	free(ts);
+	return NULL;
+    }
+    if ((ts->fp = fopen(path, "r")) == NULL) {
+	perror(path);
+	goto bad;
+    }
+
+    if (fread(&ts->hdr, sizeof(ts->hdr), 1, ts->fp) == 1 &&
+	ts->hdr.magic == TRACE_MAGIC) {
+	if (ts->hdr.version != TRACE_VERSION || ts->hdr.num_ids < 0 ||
+	    ts->hdr.num_ops < 0 || (ts->hdr.flags & ~TRACE_VARINT)) {
+	    fprintf(stderr, "Unsupported binary tracefile %s\n", path);
+	    goto bad;
+	}
+	ts->form = (ts->hdr.flags & TRACE_VARINT) ? VARINT_FORM : FIXED_FORM;
+	if (ts->form == VARINT_FORM && (ts->buf = malloc(VARINT_BUF)) == NULL) {
+	    fprintf(stderr, "Out of memory opening tracefile %s\n", path);
+	    goto bad;
+	}
+    }
+    else {
+	rewind(ts->fp);
+	if (read_rep_header(ts->fp, path, &ts->hdr) < 0)
+	    goto bad;
+	ts->form = TEXT_FORM;
+    }
+    *hdr = ts->hdr;
+    return ts;
+
+ bad:
+    trace_close(ts);
+    return NULL;
+}
+
+/*
+ * next_op - read the next request of a stream into *op. Returns 1, 0 if
+ *     the file ends here, or -1 on an error.
+ */
+static int next_op(trace_stream_t *ts, traceop_t *op)
+{
+    const unsigned char *p;
+
+    switch (ts->form) {
+    case TEXT_FORM:
+	return read_rep_op(ts->fp, ts->path, op, ts->n);
+    case FIXED_FORM:
+	return fread(op, sizeof(*op), 1, ts->fp);
+    default:
+	if (ts->hi - ts->lo < VARINT_OP && !feof(ts->fp)) {
+	    memmove(ts->buf, ts->buf + ts->lo, ts->hi - ts->lo);
+	    ts->hi -= ts->lo;
+	    ts->lo = 0;
+	    ts->hi += fread(ts->buf + ts->hi, 1, VARINT_BUF - ts->hi, ts->fp);
+	}
+	if (ts->lo == ts->hi)
+	    return 0;
+	p = ts->buf + ts->lo;
+	if (get_op(&p, ts->buf + ts->hi, op) < 0) {
+	    fprintf(stderr, "Tracefile %s is truncated or garbled\n", ts->path);
+	    return -1;
+	}
+	ts->lo = p - ts->buf;
+	return 1;
+    }
+}
+
+/*
+ * trace_read - read up to max of the next requests into ops. Returns
+ *     how many it read, 0 once all num_ops have been, or -1 on an error.
+ */
+int trace_read(trace_stream_t *ts, traceop_t *ops, int max)
+{
+    traceop_t extra;
+    int i, rc;
+
+    for (i = 0; i < max && ts->n < ts->hdr.num_ops; i++, ts->n++) {
+	if ((rc = next_op(ts, &ops[i])) <= 0) {
+	    if (rc == 0)
+		fprintf(stderr, "Tracefile %s has %d requests, not %d\n",
+			ts->path, ts->n, ts->hdr.num_ops);
+	    return -1;
+	}
+	if (check_op(ts->path, &ts->hdr, &ops[i], ts->n) < 0)
+	    return -1;
+    }
+    if (i == 0 && (rc = next_op(ts, &extra)) != 0) {
+	if (rc > 0)
+	    fprintf(stderr, "Tracefile %s has more than %d requests\n",
+		    ts->path, ts->hdr.num_ops);
+	return -1;
+    }
+    return i;
+}
+
+/*
+ * trace_close - close a stream opened by trace_open
+ */
+void trace_close(trace_stream_t *ts)
+{
+    if (ts->fp != NULL)
+	fclose(ts->fp);
+    free(ts->buf);
+    free(ts->path);
+    free(ts);
+}
+
+/*
+ * trace_write_rep - write a trace in the text form
+ */
+int trace_write_rep(FILE *fp, const trace_header_t *hdr, const traceop_t *ops)
+{
+    int i;
+
+    fprintf(fp, "%d\n%d\n%d\n%d\n", hdr->sugg_heapsize, hdr->num_ids,
+	    hdr->num_ops, hdr->weight);
+    for (i = 0; i < hdr->num_ops; i++) {
+	switch (ops[i].type) {
+	case ALLOC:
+	    fprintf(fp, "a %d %d\n", ops[i].index, ops[i].size);
+	    break;
+	case REALLOC:
+	    fprintf(fp, "r %d %d\n", ops[i].index, ops[i].size);
+	    break;
+	case MEMALIGN:
+	    fprintf(fp, "m %d %d %d\n", ops[i].index, ops[i].align,
+		    ops[i].size);
+	    break;
+	case FREE:
+	    fprintf(fp, "f %d\n", ops[i].index);
+	    break;
+	}
+    }
+    return ferror(fp) ? -1 : 0;
+}
+
+/*
+ * trace_write_bin - write a trace in the binary form, with fixed-width
+ *     requests or (if varint) varint-encoded ones
+ */
+int trace_write_bin(FILE *fp, const trace_header_t *hdr, const traceop_t *ops,
+		    int varint)
+{
+    trace_header_t h = *hdr;
+    int i;
+
+    h.magic = TRACE_MAGIC;
+    h.version = TRACE_VERSION;
+    h.flags = varint ? TRACE_VARINT : 0;
+    fwrite(&h, sizeof(h), 1, fp);
+    if (!varint) {
+	fwrite(ops, sizeof(traceop_t), h.num_ops, fp);
+	return ferror(fp) ? -1 : 0;
+    }
+    for (i = 0; i < h.num_ops; i++) {
+	putc(ops[i].type, fp);
+	put_varint(fp, ops[i].index);
+	if (ops[i].type != FREE)
+	    put_varint(fp, ops[i].size);
+	if (ops[i].type == MEMALIGN)
+	    put_varint(fp, ops[i].align);
+    }
+    return ferror(fp) ? -1 : 0;
+}
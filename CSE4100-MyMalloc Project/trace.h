@@ -0,0 +1,56 @@
+/*
+ * trace.h - trace files, in the text (.rep) form and the binary form.
+ *
+ * A binary trace is a trace_header_t followed by its num_ops requests,
+ * in host byte order. By default each request is a traceop_t, so the
+ * file can be mapped and used as the ops array as it is. With the
+ * TRACE_VARINT flag each request is instead a type byte followed by its
+ * index, size and alignment (as far as the type has them), each an
+ * unsigned LEB128 varint; such files are smaller, but are decoded on
+ * loading.
+ *
+ * trace_load reads a whole trace (mapping a fixed-width one); traces
+ * too big for that are read a chunk at a time with trace_open and
+ * trace_read.
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC 0x52544d4d /* "MMTR" when read in host byte order */
+#define TRACE_VERSION 1
+#define TRACE_VARINT 0x1       /* flags: requests are varint-encoded */
+
+/* Request types */
+enum {ALLOC, FREE, REALLOC, MEMALIGN};
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    int32_t type;                     /* type of request */
+    int32_t index;                    /* index for free() to use later */
+    int32_t size;                     /* byte size of alloc/realloc request */
+    int32_t align;                    /* alignment of memalign request */
+} traceop_t;
+
+/* The header of a binary trace (and the header lines of a text one) */
+typedef struct {
+    uint32_t magic;          /* TRACE_MAGIC */
+    uint16_t version;        /* TRACE_VERSION */
+    uint16_t flags;          /* TRACE_VARINT or 0 */
+    int32_t sugg_heapsize;   /* suggested heap size (unused) */
+    int32_t num_ids;         /* number of alloc/realloc ids */
+    int32_t num_ops;         /* number of distinct requests */
+    int32_t weight;          /* weight for this trace (unused) */
+} trace_header_t;
+
+/* A trace being read a chunk at a time */
+typedef struct trace_stream trace_stream_t;
+
+int trace_load(const char *path, trace_header_t *hdr, traceop_t **ops,
+	       void **map, size_t *map_len);
+void trace_unload(traceop_t *ops, void *map, size_t map_len);
+int trace_write_rep(FILE *fp, const trace_header_t *hdr, const traceop_t *ops);
+int trace_write_bin(FILE *fp, const trace_header_t *hdr, const traceop_t *ops,
+		    int varint);
+trace_stream_t *trace_open(const char *path, trace_header_t *hdr);
+int trace_read(trace_stream_t *ts, traceop_t *ops, int max);
+void trace_close(trace_stream_t *ts);
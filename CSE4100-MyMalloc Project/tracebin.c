@@ -0,0 +1,73 @@
+/*
+ * tracebin - convert trace files between the text (.rep) form and the
+ *            binary form (see trace.h).
+ *
+ *     tracebin [-z] in.rep out.bin    text (or binary) to binary;
+ *                                     -z writes varint-encoded requests
+ *     tracebin -d in.bin out.rep      binary (or text) back to text
+ *
+ * The input may be in either form; the trace is checked on loading.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracebin [-z] <in> <out.bin>\n");
+    fprintf(stderr, "       tracebin -d <in> <out.rep>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-d         Write the text (.rep) form.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-z         Write varint-encoded requests.\n");
+}
+
+int main(int argc, char **argv)
+{
+    trace_header_t hdr;
+    traceop_t *ops;
+    void *map;
+    size_t map_len;
+    FILE *out;
+    int c, text = 0, varint = 0, rc;
+
+    while ((c = getopt(argc, argv, "dhz")) != EOF) {
+	switch (c) {
+	case 'd':
+	    text = 1;
+	    break;
+	case 'z':
+	    varint = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 2 || (text && varint)) {
+	usage();
+	exit(1);
+    }
+
+    if (trace_load(argv[optind], &hdr, &ops, &map, &map_len) < 0)
+	exit(1);
+    if ((out = fopen(argv[optind + 1], "w")) == NULL) {
+	perror(argv[optind + 1]);
+	exit(1);
+    }
+    if (text)
+	rc = trace_write_rep(out, &hdr, ops);
+    else
+	rc = trace_write_bin(out, &hdr, ops, varint);
+    if (fclose(out) != 0 || rc < 0) {
+	perror(argv[optind + 1]);
+	exit(1);
+    }
+    trace_unload(ops, map, map_len);
+    exit(0);
+}